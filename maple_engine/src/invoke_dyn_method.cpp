@@ -39,6 +39,7 @@
 #include "jsiter.h"
 #include "jsvalueinline.h"
 #include "jsobject.h"
+#include "jspropcache.h"
 #include "jseh.h"
 #include "jstycnv.h"
 
@@ -549,12 +550,6 @@ extern "C" uint32_t __inc_opcode_cnt_dyn() {
     }\
   }
 
-struct prop_cache {
-  void *o;
-  void *p;
-  __jsvalue ret;
-} named_prop_cache[2] = {{.o = 0}};
-
 MValue InvokeInterpretMethod(DynMFunction &func) {
     uint8_t *frame_pointer = (uint8_t *)gInterSource->GetFPAddr();
     uint8_t *global_pointer = (uint8_t *)gInterSource->GetGPAddr();
@@ -1743,6 +1738,8 @@ label_OP_return:
     ret.x.u64 = 0; // return 0 means ok
     ret.ptyp = JSTYPE_NONE;
     gInterSource->InsertEplog();
+    // The return value is counted in retVal0, a good time to look for cycles.
+    GCSafepoint();
     MVALUEBITMASK(ret); // If returning void, it is set to {0x0, PTY_void}
     return ret;
   }
@@ -1936,7 +1933,6 @@ label_OP_intrinsiccall:
       MIR_ASSERT(argnums == 2);
       TValue &arg1 = MPOP();
       TValue &arg0 = MPOP();
-      named_prop_cache[1].o = 0; // invalidate cache
       CHECKREFERENCEMVALUE(arg1);
       MValue arg1_ = TValue2MValue(arg1);
       try {
@@ -1947,7 +1943,14 @@ label_OP_intrinsiccall:
           __jsstr_throw_typeerror(v1)) {
           MAPLE_JS_TYPEERROR_EXCEPTION();
         }
-        __jsop_set_this_prop_by_name(&v0, v1, &arg1_, true);
+        __jsprop_ic *ic = __jsprop_ic_get_site(func.pc);
+        __jsobject *obj = __is_js_object(&v0) ? __jsval_to_object(&v0) : NULL;
+        if (!obj || !__jsprop_ic_set(ic, obj, v1, &arg1_)) {
+          __jsop_set_this_prop_by_name(&v0, v1, &arg1_, true);
+          if (obj) {
+            __jsprop_ic_fill(ic, obj, v1, true);
+          }
+        }
       }
       CATCHINTRINSICOP();
       break;
@@ -1957,7 +1960,6 @@ label_OP_intrinsiccall:
       TValue &v2 = MPOP();
       TValue &v1 = MPOP();
       TValue &v0 = MPOP();
-      named_prop_cache[0].o = 0; // invalidate cache
       CHECKREFERENCEMVALUE(v0);
       MValue v2_ = TValue2MValue(v2);
       MValue v0_ = TValue2MValue(v0);
@@ -1967,7 +1969,15 @@ label_OP_intrinsiccall:
           __is_global_strict && __jsstr_throw_typeerror(s1)) {
           MAPLE_JS_TYPEERROR_EXCEPTION();
         }
-        __jsop_setprop_by_name(&v0_, s1, &v2_, is_strict);
+        __jsprop_ic *ic = __jsprop_ic_get_site(func.pc);
+        __jsobject *obj = __is_js_object(&v0_) ? __jsval_to_object(&v0_) : NULL;
+        // strict mode put to a non-extensible object always goes the generic way
+        if (!obj || (is_strict && !obj->extensible) || !__jsprop_ic_set(ic, obj, s1, &v2_)) {
+          __jsop_setprop_by_name(&v0_, s1, &v2_, is_strict);
+          if (obj) {
+            __jsprop_ic_fill(ic, obj, s1, true);
+          }
+        }
       }
       CATCHINTRINSICOP();
       break;
@@ -1990,20 +2000,23 @@ label_OP_intrinsiccall:
       MIR_ASSERT(argnums == 2);
       TValue &v1 = MPOP();
       TValue &v0 = MPOP();
-      if (named_prop_cache[0].o == v0.x.a64 && named_prop_cache[0].p == v1.x.a64) {
-        SetRetval0(named_prop_cache[0].ret);;
-        break;
-      }
       CHECKREFERENCEMVALUE(v0);
       MValue v1_ = TValue2MValue(v1);
       MValue v0_ = TValue2MValue(v0);
+      __jsprop_ic *ic = __jsprop_ic_get_site(func.pc);
+      __jsobject *obj = __is_js_object(&v0_) ? __jsval_to_object(&v0_) : NULL;
+      __jsstring *name = (__jsstring *)v1_.x.a64;
+      MValue retMv;
+      if (obj && __jsprop_ic_get(ic, obj, name, &retMv)) {
+        SetRetval0(retMv);
+        break;
+      }
       try {
-        MValue retMv = gInterSource->JSopGetPropByName(v0_, v1_);
+        retMv = gInterSource->JSopGetPropByName(v0_, v1_);
         SetRetval0(retMv);
-
-        named_prop_cache[0].o = v0.x.a64;
-        named_prop_cache[0].p = v1.x.a64;
-        named_prop_cache[0].ret = retMv;
+        if (obj) {
+          __jsprop_ic_fill(ic, obj, name, false);
+        }
       }
       CATCHINTRINSICOP();
       break;
@@ -2018,8 +2031,6 @@ label_OP_intrinsiccall:
       try {
         MValue retMv = gInterSource->JSopDelProp(v0_, v1_, is_strict);
         SetRetval0(retMv);
-        named_prop_cache[0].o = 0; // invalidate cache
-        named_prop_cache[1].o = 0; // invalidate cache
       }
       CATCHINTRINSICOP();
       break;
@@ -2034,8 +2045,6 @@ label_OP_intrinsiccall:
       try {
         MValue retMv = gInterSource->JSopDelProp(v0_, v1_, is_strict);
         SetRetval0(retMv);
-        named_prop_cache[0].o = 0; // invalidate cache
-        named_prop_cache[1].o = 0; // invalidate cache
       }
       CATCHINTRINSICOP();
       break;
@@ -2833,19 +2842,17 @@ label_OP_intrinsicop:
          case INTRN_JSOP_GET_THIS_PROP_BY_NAME: {
            MIR_ASSERT(argnums == 1);
            TValue &v0 = MPOP();
-
-           if (named_prop_cache[1].o == __js_Global_ThisBinding.x.a64 && named_prop_cache[1].p == v0.x.a64) {
-             retMv = named_prop_cache[1].ret;
+           MValue v0_ = TValue2MValue(v0);
+           __jsprop_ic *ic = __jsprop_ic_get_site(func.pc);
+           __jsobject *obj = __is_js_object(&__js_Global_ThisBinding) ? __jsval_to_object(&__js_Global_ThisBinding) : NULL;
+           __jsstring *name = (__jsstring *)v0_.x.a64;
+           if (obj && __jsprop_ic_get(ic, obj, name, &retMv)) {
              break;
            }
-
-           MValue v0_ = TValue2MValue(v0);
            retMv = gInterSource->JSopGetThisPropByName(v0_);
-
-           named_prop_cache[1].o = __js_Global_ThisBinding.x.a64;
-           named_prop_cache[1].p = v0.x.a64;
-           named_prop_cache[1].ret = retMv;
-
+           if (obj) {
+             __jsprop_ic_fill(ic, obj, name, false);
+           }
            break;
          }
          case INTRN_JSOP_GETPROP: {
@@ -81,15 +81,14 @@ InterSource::InterSource() {
     heap_size_ = atoi(heap_size_env) * 1024 * 1024;
     if (heap_size_ < HEAP_SIZE)
       heap_size_ = HEAP_SIZE;
-    else if (heap_size_ > 1024 * 1024 *1024)
-      heap_size_ = 1024 * 1024 *1024;
-
-    total_memory_size_ = heap_size_ + VM_MEMORY_SIZE;
+    else if (heap_size_ > HEAP_MAX_SIZE)
+      heap_size_ = HEAP_MAX_SIZE;
   } else {
-    total_memory_size_ = HEAP_SIZE + VM_MEMORY_SIZE;
-    heap_size_ = HEAP_SIZE;
+    heap_size_ = HEAP_MAX_SIZE;
   }
-  memory = (void *)malloc(heap_size_ + VM_MEMORY_SIZE);
+  total_memory_size_ = heap_size_ + VM_MEMORY_SIZE;
+  // Only address space, the memory manager commits it as the app grows.
+  memory = VMReserveMemory(total_memory_size_);
 #ifdef COULD_BE_ADDRESS
   // to test if COULD_BE_ADDRESS(v) stands
   assert(COULD_BE_ADDRESS(memory));
@@ -2208,7 +2207,7 @@ void InterSource::IntrnError(MValue *args, int numArgs) {
 
 MValue InterSource::IntrinCCall(MValue *args, int numArgs) {
   MValue mval0 = args[0];
-  const char *name = __jsval_to_string(&mval0)->x.ascii;
+  const char *name = __jsstr_get_ascii(__jsval_to_string(&mval0));
   funcCallback funcptr = getCCallback(name);
   MValue &mval1 = args[1];
   uint32 argc = mval1.x.u32;
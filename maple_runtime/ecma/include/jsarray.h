@@ -23,6 +23,34 @@
 // maximum index number use index mode
 // otherwise use string to get/set property
 #define ARRAY_MAXINDEXNUM_INTERNAL 0x10000
+// The elements of a regular array may have room for more than its length.
+// The capacity, the number of elements array_props has room for, is kept in
+// the value right before array_props[0], with the element kind. Elements
+// from the length up to the capacity are none. The capacity doubles when the
+// array outgrows it, and halves once the array is down to a quarter of it.
+// Holes past ARRAY_MAXINDEXNUM_INTERNAL are not stored, a length change
+// only makes room up to that index.
+#define ARRAY_MIN_CAPACITY 4
+
+// What the elements of a regular array can be: int32 numbers, any numbers,
+// or any values, and with JSARR_HOLEY whether some of them can be none. A
+// packed array has all its elements stored. Stores only move the kind up,
+// except that an array emptied by a length change starts over.
+enum __jsarr_elem_kind : uint8_t {
+  JSARR_PACKED_INT32 = 0,
+  JSARR_PACKED_DOUBLE = 1,
+  JSARR_PACKED_ANY = 2,
+  JSARR_HOLEY = 4,
+  JSARR_HOLEY_INT32 = JSARR_HOLEY | JSARR_PACKED_INT32,
+  JSARR_HOLEY_DOUBLE = JSARR_HOLEY | JSARR_PACKED_DOUBLE,
+  JSARR_HOLEY_ANY = JSARR_HOLEY | JSARR_PACKED_ANY,
+};
+#define JSARR_KIND_VALUES 3
+
+struct __jsarr_header {
+  uint32_t capacity;
+  uint8_t kind;
+};
 
 enum __jsarr_iter_type {
   JSARR_EVERY = 0,
@@ -35,6 +63,9 @@ enum __jsarr_iter_type {
 
 // Helper function for internal use.
 __jsobject *__js_new_arr_internal(uint32_t len);
+// For callers that store all the elements right after, the array starts
+// packed and the stores decide its kind.
+__jsobject *__js_new_arr_packed(uint32_t len);
 void __jsarr_internal_DefineOwnProperty(__jsobject *a, __jsvalue *p, __jsprop_desc desc, bool throw_p);
 void __jsarr_internal_DefineOwnPropertyByValue(__jsobject *a, uint32_t, __jsprop_desc desc, bool throw_p);
 
@@ -53,7 +84,7 @@ void __set_regular_elem(__jsvalue *arr, uint32_t index, __jsvalue *v);
 
 __jsstring *__jsarr_ElemToString(__jsvalue *elem);
 
-__jsstring *__jsarr_JoinOnce(__jsvalue *elem, __jsstring *r, __jsstring *sep);
+void __jsarr_JoinOnce(__jsstr_builder *builder, __jsvalue *elem, __jsstring *sep);
 
 // idx is guaranteed outside to be less than length
 // equivalent to __jsobj_internal_Get, not __jsobj_internal_GetOwnProperty
@@ -61,7 +92,61 @@ __jsvalue __jsarr_GetRegularElem(__jsobject *o, __jsvalue *arr, uint32_t idx);
 
 __jsvalue __jsarr_GetElem(__jsobject *o, uint32_t idx);
 
-__jsvalue *__jsarr_RegularRealloc(__jsvalue *arr, uint32_t old_len, uint32_t new_len);
+// FILLED tells that the caller stores all the added elements right after.
+__jsvalue *__jsarr_RegularRealloc(__jsvalue *arr, uint32_t old_len, uint32_t new_len, bool filled = false);
+
+static inline uint32_t &__jsarr_capacity(__jsvalue *arr) {
+  return ((__jsarr_header *)(arr - 1))->capacity;
+}
+
+static inline uint8_t &__jsarr_kind(__jsvalue *arr) {
+  return ((__jsarr_header *)(arr - 1))->kind;
+}
+
+// Whether the elements hold no references, the GC has nothing to visit.
+static inline bool __jsarr_is_numeric(__jsvalue *arr) {
+  return (__jsarr_kind(arr) & JSARR_KIND_VALUES) != JSARR_PACKED_ANY;
+}
+
+// Move the kind of ARR up so that it allows V.
+static inline void __jsarr_note_store(__jsvalue *arr, __jsvalue *v) {
+  uint8_t &kind = __jsarr_kind(arr);
+  if (kind == JSARR_HOLEY_ANY || v->ptyp == JSTYPE_NUMBER) {
+    return;
+  }
+  switch (v->ptyp) {
+    case JSTYPE_DOUBLE:
+    case JSTYPE_NAN:
+    case JSTYPE_INFINITY:
+      if ((kind & JSARR_KIND_VALUES) == JSARR_PACKED_INT32) {
+        kind |= JSARR_PACKED_DOUBLE;
+      }
+      break;
+    case JSTYPE_NONE:
+      kind |= JSARR_HOLEY;
+      break;
+    default:
+      kind = (kind & JSARR_HOLEY) | JSARR_PACKED_ANY;
+      break;
+  }
+}
+
+// The number of elements actually stored, a regular array longer than
+// ARRAY_MAXINDEXNUM_INTERNAL keeps only the first ones.
+static inline uint32_t __jsarr_stored_length(__jsvalue *arr, uint32_t len) {
+  uint32_t capacity = __jsarr_capacity(arr);
+  return len < capacity ? len : capacity;
+}
+
+// The largest capacity whose block size fits in the heap's 32-bit sizes.
+#define ARRAY_MAX_CAPACITY ((uint32_t)(UINT32_MAX / sizeof(__jsvalue) - 2))
+
+// Size of the block holding array_props, from the capacity.
+static inline uint32_t __jsarr_block_size(uint32_t capacity) {
+  uint64_t size = ((uint64_t)capacity + 2) * sizeof(__jsvalue);
+  MAPLE_JS_ASSERT(size <= UINT32_MAX && "array block size overflow");
+  return (uint32_t)size;
+}
 
 // ecma 15.4.2.1
 __jsobject *__js_new_arr_elems(__jsvalue *items, uint32_t length);
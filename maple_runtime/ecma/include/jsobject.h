@@ -20,6 +20,8 @@
 #include "jsfunction.h"
 #include "jscontext.h"
 #include "jsdataview.h"
+#include "jsshape.h"
+#include "jspropdict.h"
 #include <map>
 #include <string>
 
@@ -153,19 +155,27 @@ enum __jsobj_type {
   //     Elem0: obj.shared.array_props[1];
   //     Elem1: obj.shared.array_props[2];
   //     ...
+  //     Capacity and element kind: before obj.shared.array_props[0], see jsarray.h.
   JSREGULAR_ARRAY,
   // Special Number object for NaN and Infinity
   JSSPECIAL_NUMBER_OBJECT,
 };
 
+struct __jsregexp_program;
+
 struct __jsobject {
   // General properties' list.
   // Includes named data or accessor properties as ecma defined.
   __jsprop *prop_list;
 #ifdef USE_PROP_MAP
   std::map<uint32_t, __jsprop *> *prop_index_map;
-  std::map<__jsstring *, __jsprop *> *prop_string_map;
+  __jsprop_dict *prop_string_map;
 #endif
+  // Layout of the named properties of a regular object in shape mode, NULL if
+  // the properties live in prop_list. See jsshape.h.
+  __jsshape *shape;
+  // Values of the named properties in shape mode, indexed by slot.
+  __jsvalue *slots;
   // The prototype of this object.
   // Use id iff proto_is_builtin is true.
   union {
@@ -186,6 +196,9 @@ struct __jsobject {
   uint8_t proto_is_builtin : 2;
   // Used iff this object is a ecma builtin object.
   __jsbuiltin_object_id builtin_id;
+  // Non-zero once one of its properties is recorded by a property inline
+  // cache, which only matches while the key stays the same, see jspropcache.h.
+  uint32_t ic_key;
   // Implementation-dependent.
   // A shared field for each classification of objects.
   union {
@@ -209,6 +222,8 @@ struct __jsobject {
     // for ArrayBuffer
     __jsarraybyte *arrayByte;
     __jsdataview *dataView;
+    // Compiled pattern of a RegExp object, NULL until first used.
+    __jsregexp_program *regexp;
   } shared;
 };
 
@@ -238,6 +253,12 @@ static inline void __jsobj_set_prototype(__jsobject *obj, __jsbuiltin_object_id
 }
 
 void __jsobj_set_prototype(__jsobject *obj, __jsobject *proto_obj);
+
+// Called whenever a __jsprop of OBJ, or OBJ itself, which may be referenced by
+// a property inline cache is released. See jspropcache.h.
+static inline void __jsobj_invalidate_layout(__jsobject *obj) {
+  obj->ic_key = 0;
+}
 __jsobject *__jsobj_get_or_create_builtin(__jsbuiltin_object_id id);
 static inline __jsobject *__jsobj_get_prototype(__jsobject *obj) {
   if (obj->proto_is_builtin) {
@@ -248,6 +269,7 @@ static inline __jsobject *__jsobj_get_prototype(__jsobject *obj) {
 
 void __jsobj_helper_reject(bool throw_p);
 void __jsobj_helper_convert_to_generic(__jsobject *obj);
+void __jsobj_helper_shape_to_props(__jsobject *obj);
 void __jsobj_helper_add_value_property(__jsobject *obj, __jsvalue *name, __jsvalue *v, uint32_t attrs, __jsprop *prop_cache = NULL);
 void __jsobj_helper_add_value_property(__jsobject *obj, __jsstring *name, __jsvalue *v, uint32_t attrs, __jsprop *prop_cache = NULL);
 void __jsobj_helper_add_value_property(__jsobject *obj, __jsbuiltin_string_id id, __jsvalue *v, uint32_t attrs, __jsprop *prop_cache = NULL);
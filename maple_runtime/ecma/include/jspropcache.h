@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+/// Per call-site inline caches for named property access.
+///
+/// Each JSOP_GETPROP_BY_NAME, JSOP_SETPROP_BY_NAME and (GET|SET)_THIS_PROP_BY_NAME
+/// instruction owns one __jsprop_ic, found by hashing the address of the
+/// instruction into a table that grows with the number of sites. A site starts
+/// uninitialized, becomes monomorphic after its first fill, polymorphic (up to
+/// JSPROP_IC_WAYS entries) when it sees other receivers, and megamorphic when it
+/// keeps missing; a megamorphic site no longer fills and always takes the
+/// generic path.
+///
+/// For receivers in shape mode an entry remembers (shape, name) -> slot and is
+/// shared by every object of that shape; shapes are immutable and never freed.
+/// For other receivers it remembers the own __jsprop found for (receiver, name).
+/// The value is always read from or written to the property itself, and the
+/// descriptor is re-checked on every hit, so attribute changes (freeze, accessor
+/// redefinition, mark_as_deleted) need no invalidation. The entries of a receiver
+/// also remember its ic_key, which __jsobj_invalidate_layout clears whenever one
+/// of its cached __jsprop or the receiver itself is released, so that they no
+/// longer match.
+#ifndef JSPROPCACHE_H
+#define JSPROPCACHE_H
+
+#include "jsvalue.h"
+#include "jsobject.h"
+#include "jsobjectinline.h"
+
+#define JSPROP_IC_WAYS 4
+#define JSPROP_IC_MIN_SITES 1024  // must be a power of 2
+// Number of misses a full polymorphic site tolerates before going megamorphic.
+#define JSPROP_IC_MEGA_MISSES 64
+
+enum __jsprop_ic_state : uint8_t {
+  JSPROP_IC_UNINIT,
+  JSPROP_IC_MONO,
+  JSPROP_IC_POLY,
+  JSPROP_IC_MEGA,
+};
+
+struct __jsprop_ic_entry {
+  // Non-NULL if the entry matches any receiver of this shape, see jsshape.h.
+  __jsshape *shape;
+  __jsobject *obj;
+  // The ic_key of obj when the entry was filled.
+  uint32_t key;
+  __jsstring *name;
+  union {
+    __jsprop *prop;
+    uint32_t slot;
+  } u;
+};
+
+struct __jsprop_ic {
+  const void *site;
+  __jsprop_ic_state state;
+  uint8_t num_entries;
+  uint8_t victim;
+  uint8_t misses;
+  __jsprop_ic_entry entries[JSPROP_IC_WAYS];
+};
+
+// Open addressed table of the sites seen so far, indexed by their hashed
+// address. Caches are allocated once per site and never move or go away.
+extern __jsprop_ic **__jsprop_ic_sites;
+extern uint32_t __jsprop_ic_sites_mask;
+
+__jsprop_ic *__jsprop_ic_add_site(const void *site);
+
+static inline uint32_t __jsprop_ic_hash(const void *site) {
+  return (uint32_t)((uintptr_t)site >> 2);
+}
+
+// Return the inline cache of the instruction at SITE.
+static inline __jsprop_ic *__jsprop_ic_get_site(const void *site) {
+  __jsprop_ic *ic = __jsprop_ic_sites[__jsprop_ic_hash(site) & __jsprop_ic_sites_mask];
+  if (ic && ic->site == site) {
+    return ic;
+  }
+  return __jsprop_ic_add_site(site);
+}
+
+static inline __jsprop_ic_entry *__jsprop_ic_probe(__jsprop_ic *ic, __jsobject *obj, __jsstring *name) {
+  for (uint32_t i = 0; i < ic->num_entries; i++) {
+    __jsprop_ic_entry *e = &ic->entries[i];
+    if (e->name == name && (e->shape ? e->shape == obj->shape : e->obj == obj && e->key == obj->ic_key)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+// Plain data property, i.e. neither accessor nor marked as deleted.
+static inline bool __jsprop_ic_is_plain_data(__jsprop_desc desc) {
+  return (desc.s.fields & (JSPROP_HAS_GET | JSPROP_HAS_SET | JSPROP_UNDEFINED)) == 0;
+}
+
+// Fast path of a named get. Return false if the generic path has to be taken.
+static inline bool __jsprop_ic_get(__jsprop_ic *ic, __jsobject *obj, __jsstring *name, __jsvalue *result) {
+  __jsprop_ic_entry *e = __jsprop_ic_probe(ic, obj, name);
+  if (!e) {
+    return false;
+  }
+  if (e->shape) {
+    *result = obj->slots[e->u.slot];
+    return true;
+  }
+  if (!__jsprop_ic_is_plain_data(e->u.prop->desc)) {
+    return false;
+  }
+  *result = __get_value(e->u.prop->desc);
+  return true;
+}
+
+// Fast path of a named put to an existing own writable data property.
+static inline bool __jsprop_ic_set(__jsprop_ic *ic, __jsobject *obj, __jsstring *name, __jsvalue *v) {
+  __jsprop_ic_entry *e = __jsprop_ic_probe(ic, obj, name);
+  if (!e) {
+    return false;
+  }
+  if (e->shape) {
+    __jsvalue *to = &obj->slots[e->u.slot];
+    GCCheckAndUpdateRf(to->x.asbits, IsNeedRc(to->ptyp), v->x.asbits, IsNeedRc(v->ptyp));
+    *to = *v;
+    return true;
+  }
+  __jsprop *prop = e->u.prop;
+  if (!__jsprop_ic_is_plain_data(prop->desc) || !__has_and_writable(prop->desc)) {
+    return false;
+  }
+  __set_value_gc(&prop->desc, v);
+  return true;
+}
+
+// Record the own property NAME of OBJ in IC after the generic path succeeded.
+void __jsprop_ic_fill(__jsprop_ic *ic, __jsobject *obj, __jsstring *name, bool for_set);
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+/// Dictionary of the named properties of an object (prop_string_map).
+///
+/// An open-addressing hash table with linear probing, allocated from the
+/// managed heap. Keys are atoms (see __jsstr_intern), so a key is hashed and
+/// compared by address. Removed entries become tombstones until the next
+/// rehash. The dictionary only indexes prop_list, it holds no references.
+#ifndef JSPROPDICT_H
+#define JSPROPDICT_H
+
+#include "jsvalue.h"
+#include "jsstring.h"
+
+struct __jsprop;
+
+#define JSPROP_DICT_MIN_CAPACITY 8  // must be a power of 2
+// Marks the key of a removed entry.
+#define JSPROP_DICT_TOMBSTONE ((__jsstring *)1)
+
+struct __jsprop_dict_entry {
+  __jsstring *name;
+  __jsprop *prop;
+};
+
+struct __jsprop_dict {
+  uint32_t capacity;
+  // Number of live entries.
+  uint32_t count;
+  // Number of live entries and tombstones.
+  uint32_t used;
+  __jsprop_dict_entry *entries;
+};
+
+__jsprop_dict *__jsprop_dict_new();
+void __jsprop_dict_free(__jsprop_dict *dict);
+// Map NAME to PROP, replacing the property NAME was mapped to.
+void __jsprop_dict_put(__jsprop_dict *dict, __jsstring *name, __jsprop *prop);
+// Unmap NAME, return the property it was mapped to or NULL.
+__jsprop *__jsprop_dict_remove(__jsprop_dict *dict, __jsstring *name);
+
+static inline uint32_t __jsprop_dict_hash(__jsstring *name) {
+  uint64_t h = (uint64_t)(uintptr_t)name;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return (uint32_t)h;
+}
+
+static inline __jsprop *__jsprop_dict_get(__jsprop_dict *dict, __jsstring *name) {
+  uint32_t mask = dict->capacity - 1;
+  for (uint32_t i = __jsprop_dict_hash(name) & mask;; i = (i + 1) & mask) {
+    __jsprop_dict_entry *e = &dict->entries[i];
+    if (e->name == name) {
+      return e->prop;
+    }
+    if (!e->name) {
+      return NULL;
+    }
+  }
+}
+
+static inline bool __jsprop_dict_empty(__jsprop_dict *dict) {
+  return dict->count == 0;
+}
+#endif
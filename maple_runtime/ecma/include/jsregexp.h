@@ -19,6 +19,56 @@
 #include <pcre.h>
 #include "jsvalue.h"
 
+// Patterns without captures, assertions or alternatives that are a literal
+// string (/foo/, /\n/) or a single character class, optionally repeated with
+// + (/\s+/, /[,;]/), are recognized at compile time and matched without jscre.
+enum __jsregexp_kind : uint8_t {
+  JSREGEXP_GENERAL,
+  JSREGEXP_LITERAL,
+  JSREGEXP_CLASS,
+};
+
+struct __jsregexp_class {
+  // Code units below 256 in the class.
+  uint8_t bits[32];
+  // Set if the class has \s, its members above 255 are the spaces there.
+  bool unicode_space;
+  bool negated;
+  // Set for a class followed by +.
+  bool repeated;
+};
+
+// A compiled pattern. RegExp objects with the same source and flags share one
+// through a cache of the JSREGEXP_CACHE_SIZE most recently compiled patterns,
+// so that e.g. a literal in a loop is compiled once.
+struct __jsregexp_program {
+  dart::jscre::JSRegExp *re;
+  unsigned num_captures;
+  // Number of RegExp objects and cache entries referencing the program.
+  uint32_t refcount;
+  __jsregexp_kind kind;
+  // The string to find for JSREGEXP_LITERAL, referenced by the program.
+  __jsstring *literal;
+  // The class to find for JSREGEXP_CLASS.
+  __jsregexp_class cls;
+};
+
+#define JSREGEXP_CACHE_SIZE 64
+
+// Return the program of the RegExp object OBJ, compiled on first use. Return
+// NULL and set *ERROR_MESSAGE if the pattern doesn't compile.
+__jsregexp_program *__jsregexp_get_program(__jsobject *obj, const char **error_message);
+// Same as __jsregexp_get_program for executing OBJ: return NULL if its pattern
+// ends prematurely, such a RegExp never matches, and throw SyntaxError for
+// other errors.
+__jsregexp_program *__jsregexp_get_exec_program(__jsobject *obj);
+void __jsregexp_release_program(__jsregexp_program *program);
+// Match PROGRAM against JS_SUBJECT from START_OFFSET, as RegExpExecute.
+int __jsregexp_execute(__jsregexp_program *program, __jsstring *js_subject,
+                       int start_offset, int *offsets, int offset_count);
+// Drop what RegExpExecute keeps of the last subject, once done matching it.
+void __jsregexp_release_subject();
+
 __jsobject *__js_ToRegExp(__jsstring *jsstr);
 
 __jsvalue __js_new_regexp_obj(__jsvalue *this_value, __jsvalue *arg_list,
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+/// Shapes (hidden classes) of regular objects.
+///
+/// A shape describes the layout of the named properties of a JSREGULAR_OBJECT:
+/// the name kept in each slot, in insertion order. All properties described by a
+/// shape are data properties with default attributes (JSPROP_DESC_HAS_VWEC), so
+/// an object in shape mode only needs its values, stored in obj->slots.
+///
+/// Shapes form a transition tree rooted at the empty shape. Adding property P to
+/// an object of shape S moves it to the child of S labelled P, so objects built
+/// the same way share one shape. Shapes are never released.
+///
+/// An object leaves shape mode (see __jsobj_helper_convert_to_generic) as soon as
+/// it needs anything a shape cannot describe: index properties, accessors,
+/// non-default attributes, deletion, or too many properties.
+#ifndef JSSHAPE_H
+#define JSSHAPE_H
+
+#include "jsvalue.h"
+#include "jsstring.h"
+
+// Objects with more named properties than this go back to the property list.
+#define JSSHAPE_MAX_SLOTS 32
+// A shape with this many transitions is considered used as a dictionary.
+#define JSSHAPE_MAX_TRANSITIONS 16
+
+struct __jsshape {
+  __jsshape *parent;
+  // names[i] is the name of slot i, for all slot_count slots.
+  __jsstring **names;
+  uint32_t slot_count;
+  uint32_t num_transitions;
+  __jsshape *first_child;
+  __jsshape *next_sibling;
+};
+
+__jsshape *__jsshape_get_root();
+// Return the child of SHAPE which adds NAME, or NULL if SHAPE may not grow.
+__jsshape *__jsshape_add_transition(__jsshape *shape, __jsstring *name);
+
+// Return the slot of NAME in SHAPE, or -1.
+static inline int32_t __jsshape_lookup(__jsshape *shape, __jsstring *name) {
+  __jsstring **names = shape->names;
+  uint32_t n = shape->slot_count;
+  for (uint32_t i = 0; i < n; i++) {
+    if (names[i] == name) {
+      return (int32_t)i;
+    }
+  }
+  // Slot names are atoms, a copy of one can only match through its atom.
+  __jsstring *atom = __jsstr_lookup_atom(name);
+  if (!atom || atom == name) {
+    return -1;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    if (names[i] == atom) {
+      return (int32_t)i;
+    }
+  }
+  return -1;
+}
+
+// Number of __jsvalue allocated for the slots of an object with COUNT slots.
+static inline uint32_t __jsshape_slot_capacity(uint32_t count) {
+  uint32_t cap = 4;
+  while (cap < count) {
+    cap <<= 1;
+  }
+  return cap;
+}
+#endif
@@ -27,33 +27,130 @@ enum __jsbuiltin_string_id {
 enum __jsstring_type : uint8_t {
     JSSTRING_UNICODE = 0x1,    // Bit is set for 16-bit code units
     JSSTRING_GEN = 0x2,        // Bit is set for non-const code units
-    JSSTRING_BUILTIN = 0x4     // Bit is set for built-in strings
+    JSSTRING_BUILTIN = 0x4,    // Bit is set for built-in strings
+    JSSTRING_ATOM = 0x8,       // Bit is set for heap strings in the atom table
+    JSSTRING_ROPE = 0x10,      // Bit is set for concatenations not copied yet
+    JSSTRING_DEPENDENT = 0x20  // Bit is set for substrings sharing their parent's code units
 };
 
+// Concatenations shorter than this are copied right away.
+#define JSSTRING_ROPE_MIN_LENGTH 32
+// Substrings shorter than this are copied right away.
+#define JSSTRING_DEPENDENT_MIN_LENGTH 24
+// A heap parent is only shared by substrings at least 1/JSSTRING_DEPENDENT_MAX_RATIO
+// of its length, so that a small substring doesn't keep a big string alive.
+#define JSSTRING_DEPENDENT_MAX_RATIO 8
+
 // Compress js-string's representation.
+// Constant strings, emitted by the compiler or builtin:
 // |..8 bits..|..8 bits..|..8 bits..|..8 bits..|....actual chars's bytes....|
 // | CLASS    |ID-bistring|LENGTH1  | LENGTH2  |      actual data           |
+// Strings generated at run time (JSSTRING_GEN) have a wider header:
+// |..8 bits..|..8 bits..|..16 bits..|..32 bits..|..32 bits..|..actual data..|
+// | CLASS    |    0     |    0      |  LENGTH   |   HASH    |               |
 
 typedef struct {
     __jsstring_type        kind    : 8;
     __jsbuiltin_string_id  builtin : 8;
+    // Length of a constant string, use __jsstr_get_length.
     uint16_t               length;
-    union {
-        char               ascii[0];
-        char16_t           utf16[0];
-    } x;
 } __jsstring;
 
+typedef struct {
+    __jsstring             head;
+    uint32_t               length;
+    // __jsstr_hash of the string, 0 until computed.
+    uint32_t               hash;
+} __jsstring_gen;
+
+// A rope (JSSTRING_GEN | JSSTRING_ROPE) is the concatenation of left and
+// right, which it keeps alive. The code units are only copied, to flat, the
+// first time they are needed; left and right are released at that point.
+// An operand without references is copied rather than referenced, as its
+// caller still owns it.
+typedef struct {
+    __jsstring_gen         gen;
+    __jsstring             *left;
+    __jsstring             *right;
+    __jsstring             *flat;
+} __jsstring_rope;
+
+// A dependent string (JSSTRING_GEN | JSSTRING_DEPENDENT) is the substring of
+// length code units of parent starting at offset, which it keeps alive. The
+// parent is always a flat string, never a rope or another dependent string.
+typedef struct {
+    __jsstring_gen         gen;
+    __jsstring             *parent;
+    uint32_t               offset;
+} __jsstring_dep;
+
 typedef char16_t __jschar;
 
+// Return the flat string with the content of the rope STR.
+__jsstring *__jsstr_flatten(__jsstring *str);
+// Return the code units of a rope or dependent string.
+void *__jsstr_get_chars_slow(__jsstring *str);
+
+inline bool __jsstr_is_rope(__jsstring *str) {
+  return (str->kind & JSSTRING_ROPE) != 0;
+}
+
+inline bool __jsstr_is_dependent(__jsstring *str) {
+  return (str->kind & JSSTRING_DEPENDENT) != 0;
+}
+
+inline bool __jsstr_is_gen(__jsstring *str) {
+  return (str->kind & JSSTRING_GEN) != 0;
+}
+
 inline uint32_t __jsstr_get_length(__jsstring *str) {
-    return (uint32_t)str->length;
+  return __jsstr_is_gen(str) ? ((__jsstring_gen *)str)->length : (uint32_t)str->length;
+}
+
+inline uint32_t __jsstr_header_size(__jsstring *str) {
+  return __jsstr_is_gen(str) ? sizeof(__jsstring_gen) : sizeof(__jsstring);
+}
+
+// The code units of an ascii string.
+inline char *__jsstr_get_ascii(__jsstring *str) {
+  if (str->kind & (JSSTRING_ROPE | JSSTRING_DEPENDENT)) {
+    return (char *)__jsstr_get_chars_slow(str);
+  }
+  return (char *)str + __jsstr_header_size(str);
+}
+
+// The code units of a unicode string.
+inline uint16_t *__jsstr_get_utf16(__jsstring *str) {
+  if (str->kind & (JSSTRING_ROPE | JSSTRING_DEPENDENT)) {
+    return (uint16_t *)__jsstr_get_chars_slow(str);
+  }
+  return (uint16_t *)((char *)str + __jsstr_header_size(str));
 }
 
 inline bool __jsstr_is_ascii(__jsstring *str) {
   return (str->kind & JSSTRING_UNICODE) == 0;
 }
 
+// Growable buffer to build a string piece by piece in amortized linear time.
+// The buffer is a generated string on the VM heap whose length is the
+// capacity; it holds ascii code units until a unicode one is appended. Use
+// __jsstr_builder_finish to take the result, the destructor releases the
+// buffer of a builder left unfinished, e.g. by an exception.
+struct __jsstr_builder {
+  __jsstring *buf;
+  uint32_t length;
+  __jsstr_builder() : buf(NULL), length(0) {}
+  ~__jsstr_builder();
+};
+
+void __jsstr_builder_append_char(__jsstr_builder *builder, uint16_t ch);
+void __jsstr_builder_append_ascii(__jsstr_builder *builder, const char *chars, uint32_t length);
+void __jsstr_builder_append(__jsstr_builder *builder, __jsstring *str);
+// Append the LENGTH code units of STR starting at FROM.
+void __jsstr_builder_append_range(__jsstr_builder *builder, __jsstring *str, uint32_t from, uint32_t length);
+// Return the string built so far and reset BUILDER.
+__jsstring *__jsstr_builder_finish(__jsstr_builder *builder);
+
 bool __is_UnicodeSpace(wchar_t c);
 
 void __jsstr_dump(__jsstring *str);
@@ -96,9 +193,25 @@ __jsvalue __jsstr_split(__jsvalue *this_string, __jsvalue *separator, __jsvalue
 __jsvalue __jsstr_match(__jsvalue *this_string, __jsvalue *regexp);
 __jsvalue __jsstr_search(__jsvalue *this_string, __jsvalue *regexp);
 __jsvalue __jsstr_replace(__jsvalue *this_string, __jsvalue *search, __jsvalue *replace);
+// Return the substring of LENGTH code units of FROM starting at FROM_INDEX. It
+// may share the code units of FROM, so it must not be modified.
 __jsstring *__jsstr_extract(__jsstring *from, uint32_t from_index, uint32_t length);
 std::wstring __jsstr_to_wstring(__jsstring *s, int offset = 0);
 uint32_t __jsstr_is_number(__jsstring *);
 uint32_t __jsstr_is_numidx(__jsstring *p, bool &isNum);
 bool __jsstr_throw_typeerror(__jsstring *);
+
+// Atom table. Property names are interned so that own properties can be found
+// by comparing pointers. The table doesn't keep its strings alive: a heap atom
+// leaves the table when it's recalled (see MemoryManager::RecallString).
+// Hash of the content, cached in generated strings.
+uint32_t __jsstr_hash(__jsstring *str);
+// Return the atom with the content of STR, making STR the atom if there is none.
+__jsstring *__jsstr_intern(__jsstring *str);
+// Same as __jsstr_intern for the LENGTH ascii chars at CHARS, only allocates
+// if the atom doesn't exist yet.
+__jsstring *__jsstr_intern_ascii(const char *chars, uint32_t length);
+// Return the atom with the content of STR, or NULL if STR isn't interned.
+__jsstring *__jsstr_lookup_atom(__jsstring *str);
+void __jsstr_remove_atom(__jsstring *str);
 #endif
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+/// Substring search for String.prototype.indexOf and lastIndexOf.
+///
+/// Both strings are searched through their code units, ascii or utf16. On
+/// x86-64 the candidate positions are filtered 16 (SSE2) or 32 (AVX2, when the
+/// CPU has it) bytes at a time by comparing the first and the last code unit
+/// of the needle, and only the candidates passing both are compared in full.
+/// Other targets, and the tail of the haystack, use a scalar loop. The kernels
+/// are picked once, the first time a search runs.
+#ifndef JSSTRSEARCH_H
+#define JSSTRSEARCH_H
+
+#include "jsvalue.h"
+#include "jsstring.h"
+
+// Return the index of the first occurrence of NEEDLE in HAYSTACK at or after
+// FROM, or -1.
+int64_t __jsstr_find(__jsstring *haystack, __jsstring *needle, uint32_t from);
+// Return the index of the last occurrence of NEEDLE in HAYSTACK at or after
+// FROM, or -1.
+int64_t __jsstr_find_last(__jsstring *haystack, __jsstring *needle, uint32_t from);
+#endif
@@ -19,9 +19,9 @@
 #ifdef TEST_BENCHMARK
 #define APP_MEMORY_SIZE (12 * 1024 * 1024)       // 12M application memory
 // make sure VM_MEMORY_SIZE == VM_MEMORY_BIG_SIZE + VM_MEMORY_SMALL_SIZE
-#define VM_MEMORY_BIG_SIZE (4 * 1024 * 1024)    // 4M
-#define VM_MEMORY_SMALL_SIZE (2 * 1024 * 1024)  // 2M
-#define VM_MEMORY_SIZE (8 * 1024 * 1024)        // 8M VM internal data
+#define VM_MEMORY_BIG_SIZE (48 * 1024 * 1024)    // 48M
+#define VM_MEMORY_SMALL_SIZE (16 * 1024 * 1024)  // 16M
+#define VM_MEMORY_SIZE (64 * 1024 * 1024)        // 64M VM internal data
 #define TOTAL_MEMORY_SIZE (APP_MEMORY_SIZE + VM_MEMORY_SIZE)
 #define STACKOFFSET APP_MEMORY_SIZE
 
@@ -47,6 +47,15 @@
 #define MAXCALLARGNUM 10
 #endif
 
+// The heap and the VM internal data are reserved as address space and only
+// committed as they are used, HEAP_COMMIT_CHUNK bytes at a time. The sizes
+// above are the reservations. Unless MAPLE_HEAP_SIZE (in MB) asks for less,
+// the heap reserves HEAP_MAX_SIZE. The top HEAP_STACK_SIZE bytes of the heap
+// hold the stack and are committed up front.
+#define HEAP_MAX_SIZE (1024 * 1024 * 1024)
+#define HEAP_STACK_SIZE (8 * 1024 * 1024)
+#define HEAP_COMMIT_CHUNK (1024 * 1024)
+
 // The stack of (pending) operands for next few (virtual) instructions
 // (expression or statements). This is for MJSVM-CMPL (v2)
 #define OPERANDS_STACK_SIZE 128
@@ -26,6 +26,11 @@
 #include "json.h"
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 using namespace maple;
 
 #if MACHINE64
@@ -52,17 +57,15 @@ enum MemHeadTag {
 /* Enumeration flags to distinguish different management of object, prop and environment.
    DECREASE for detecting garbage reference cycles by decrement of the reference count.
    RESTORE for restoring the reference count of non-garbage objects.
+   UNMARK for restoring the reference counts decreased by a marking given up.
+   SCAN for finding the objects whose references all come from the trial deleted ones.
    COLLECT for collecting the objects in garbage cycles.
    SWEEP for releasing the garbage reference cycles.
    RECALL for normal garbage collection when reference count reduce to zero. */
-enum ManageType { DECREASE, RESTORE, COLLECT, SWEEP, RECALL };
+enum ManageType { DECREASE, RESTORE, UNMARK, SCAN, COLLECT, SWEEP, RECALL };
 
-// struct to maintain cycle roots
-struct CycleRoot {
-  struct CycleRoot *pre;
-  struct CycleRoot *next;
-  __jsobject *obj;
-};
+// Colors of an object during a cycle collection, black outside of one.
+enum CycleColor { CycleBlack, CycleGray, CycleWhite, CycleGarbage };
 #else
 /* Enumeration flags to distinguish different management of object, prop and environment.
    MARK for setting the marked flag of object to true.
@@ -81,10 +84,9 @@ struct MemHeader {
   uint16 refcount : 14;
   MemHeadTag memheadtag : 3;
 #ifdef MARK_CYCLE_ROOTS
-  bool is_root : 1;
-  bool is_decreased : 1;
-  bool need_restore : 1;
-  bool is_collected : 1;
+  bool is_root : 1;      // buffered as a candidate cycle root
+  bool is_released : 1;  // dead while buffered, the collector frees it
+  uint16 cycle_color : 2;
   uint16 : 11;
 #else
   uint16 : 15;
@@ -110,21 +112,137 @@ struct ExMemHeader {
 struct MemoryChunk {
   uint32 offset_;
   uint32 size_;
+  bool zero_;  // the memory is known to be all zero
   MemoryChunk *next;
 };
 
+struct BigFreeChunk {
+  uint32 size_;
+  bool zero_;
+};
+
 #define UINT14_MAX 0x3fff
+// A count that does not fit the 14 bits of MemHeader is kept in
+// MemoryManager::rc_overflow_, the header then holds UINT14_MAX. It goes back
+// to the header once it is down to RC_OVERFLOW_RETURN, far enough from the
+// limit not to move back and forth.
+#define RC_OVERFLOW_RETURN (UINT14_MAX / 2)
+
+// An object whose count drops to 0 is queued, RECALL_PROMPT_WORK queued objects
+// are recalled right away and the rest RECALL_PAUSE_WORK at a time, at
+// safepoints and when an allocation would otherwise grow the heap.
+#define RECALL_PROMPT_WORK 256
+#define RECALL_PAUSE_WORK 4096
+
+// Releasing a block may need a MemoryChunk descriptor, and running out of VM
+// memory there is fatal. The allocation entry points keep room for
+// MEMCHUNK_RESERVE more descriptors committed, or throw a RangeError.
+#define MEMCHUNK_RESERVE 1024
+
+// Cycle collection runs at safepoints once the heap allocated CYCLE_GROWTH_MIN
+// bytes, or as many bytes as its footprint if that is more, since the last
+// one, or when CYCLE_ROOTS_MAX candidate roots are buffered. A pause marks at
+// most CYCLE_PAUSE_WORK objects, the later phases only visit those. A
+// candidate whose marking would go over gives the counts back and waits for
+// the next safepoint, which has twice the budget if no candidate fit in it.
+#define CYCLE_GROWTH_MIN (4 * 1024 * 1024)
+#define CYCLE_ROOTS_MAX 0x10000
+#define CYCLE_PAUSE_WORK 0x4000
+
+// Heap blocks of up to SLAB_MAX_SIZE bytes, MemHeader included, are carved
+// from slabs: SLAB_PAGE_SIZE pages of the small heap split into blocks of a
+// single size class. Classes are 8 bytes apart up to 128 bytes, then 16 bytes
+// apart up to SLAB_MAX_SIZE.
+#define SLAB_PAGE_SIZE 4096
+#define SLAB_MAX_SIZE 256
+#define SLAB_NUM_CLASSES 24
+// Empty pages beyond this many go back to the free chunks of the heap.
+#define SLAB_POOL_MAX_PAGES 64
+
+// Header at the start of each slab page. Offsets are relative to the page, a
+// recycled block keeps the offset of the next one right after its MemHeader.
+struct SlabPage {
+  SlabPage *next_;  // next page of the class with room, or next page of the pool
+  SlabPage *prev_;
+  uint16 free_;     // first recycled block, 0 if none
+  uint16 bump_;     // first block never handed out
+  uint16 live_;     // blocks handed out
+  uint8 class_;
+  bool fresh_;      // the page was zero when it was carved and never released
+};
+
+#define SLAB_HEADER_SIZE ((sizeof(SlabPage) + 7) & ~(size_t)7)
+
+static inline uint32 SlabClassIndex(uint32 size) {
+  return size <= 128 ? (size + 7) / 8 - 1 : 16 + (size - 129) / 16;
+}
+
+static inline uint32 SlabClassSize(uint32 index) {
+  return index < 16 ? (index + 1) * 8 : 128 + (index - 15) * 16;
+}
+
+// Heap blocks of FREE_BACKGROUND_MIN bytes or more are zeroed by a background
+// thread when they are released, and only go back to the free chunks, known
+// zero, once it is done. At most FREE_RING_SIZE - 1 of them are on the way
+// each way, the others are released at once.
+#define FREE_BACKGROUND_MIN (256 * 1024)
+#define FREE_RING_SIZE 64
+
+// Blocks handed from one thread to another, without locks: only the producer
+// moves tail_ and only the consumer moves head_.
+struct FreeRing {
+  std::atomic<uint32> head_;
+  std::atomic<uint32> tail_;
+  uint32 offset_[FREE_RING_SIZE];
+  uint32 size_[FREE_RING_SIZE];
+
+  void Init() {
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+  }
+  bool Empty() {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+  bool Push(uint32 offset, uint32 size) {
+    uint32 tail = tail_.load(std::memory_order_relaxed);
+    uint32 next = (tail + 1) % FREE_RING_SIZE;
+    if (next == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    offset_[tail] = offset;
+    size_[tail] = size;
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+  bool Pop(uint32 *offset, uint32 *size) {
+    uint32 head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    *offset = offset_[head];
+    *size = size_[head];
+    head_.store((head + 1) % FREE_RING_SIZE, std::memory_order_release);
+    return true;
+  }
+};
 
 class MemoryHash {
  public:
   MemoryChunk *table_[MEMHASHTABLESIZE];
+  // Free chunks too big for table_, merged with their free neighbours when
+  // they are released. They are indexed by offset to find the neighbours, and
+  // by size then offset for best fit.
+  std::map<uint32, BigFreeChunk> big_by_offset_;
+  std::set<std::pair<uint32, uint32>> big_by_size_;
 
  public:
   MemoryHash() {}
 
   MemoryChunk *GetFreeChunk(uint32);  // get the free chunk and release it
+  MemoryChunk *GetAlignedChunk(uint32 size, uint32 align);
+  bool TakeBigChunkAt(uint32 offset, uint32 size, bool *zero);
   void PutFreeChunk(MemoryChunk *);
-  void MergeBigFreeChunk();
+  void PutBigFreeChunk(uint32 offset, uint32 size, bool zero);
   bool IsBigSize(uint32 size) {
     return ((size >> 2) >= MEMHASHTABLESIZE);
   }
@@ -144,6 +262,7 @@ class MemoryManager {
   void *gpMemory;      // points to the global memory
   uint32 total_size_;  // total memory size of the app's heap
   uint32 total_small_size_;
+  uint32 heap_limit_;  // end of the big heap, the stack is above it
   uint32 heap_free_small_offset_;
   uint32 heap_free_big_offset_;   // for gc
   MemoryHash *heap_memory_bank_;  // for app need gc
@@ -193,6 +312,38 @@ class MemoryManager {
   uint32 vm_free_big_offset_;       // big memory offset
   MemoryHash *vm_memory_bank_;      // for vm itself, no need gc
   MemoryChunk *free_memory_chunk_;  // for memory chunk descriptor only, reusable
+  // The heap and the VM's memory are one reserved range of address space,
+  // each region bumping through it commits as it goes (see Commit).
+  uint8 *reserved_begin_;
+  uint8 *reserved_end_;
+  uint8 *heap_small_committed_;     // end of the committed part of each region
+  uint8 *heap_big_committed_;
+  uint8 *vm_small_committed_;
+  uint8 *vm_big_committed_;
+  SlabPage *slab_partial_[SLAB_NUM_CLASSES];  // pages of each class with room
+  SlabPage *slab_pool_;             // empty slab pages, reusable by any class
+  uint32 slab_pool_size_;
+  std::unordered_map<void *, uint32> rc_overflow_;  // counts of UINT14_MAX and more
+  std::vector<__jsobject *> recall_queue_;  // objects left without references
+  FreeRing free_pending_;   // released blocks for the free thread to zero
+  FreeRing free_done_;      // and the ones it zeroed
+  uint32 free_outstanding_; // blocks given to the free thread not yet taken back
+  bool free_thread_started_;
+  std::mutex free_mutex_;   // only to sleep, the rings need no lock
+  std::condition_variable free_cv_;
+  bool recall_draining_;
+#ifdef MARK_CYCLE_ROOTS
+  std::vector<__jsobject *> cycle_roots_;    // candidate cycle roots, flagged is_root
+  std::vector<__jsobject *> cycle_stack_;    // objects left to visit by a phase
+  std::vector<__jsobject *> cycle_garbage_;  // objects of the garbage cycles found
+  std::vector<__jsobject *> cycle_marked_;   // objects marked from the current candidate
+  // Decrements DECREASE skipped on objects already at 0, RESTORE skips as many.
+  std::unordered_map<__jsobject *, uint32> cycle_skipped_;
+  uint32 cycle_alloc_bytes_;    // heap bytes allocated since the last collection
+  uint32 cycle_trigger_bytes_;  // collect once cycle_alloc_bytes_ reaches it
+  uint32 cycle_work_;           // objects marked by the current pause
+  uint32 cycle_budget_;         // objects the current pause may mark
+#endif
 #ifndef RC_NO_MMAP
   AddrMap *free_mmaps_;           // a link list of mmaps for reuse.
   AddrMapNode *free_mmap_nodes_;  // a link list of mmap node for reuse.
@@ -220,7 +371,14 @@ class MemoryManager {
   void ReleaseVariables(uint8_t *base, uint8_t *typetagged, uint8_t *refcounted, uint32_t size, bool reversed);
   // malloc for application objects, reference counted
   void *Malloc(uint32 size, bool init_p = true);
-  void *Realloc(void *, uint32, uint32);
+  void *Realloc(void *, uint32, uint32, bool init_p = true);
+  bool ResizeInPlace(uint32 offset, uint32 oldsize, uint32 newsize, bool init_p);
+  void *SlabMalloc(uint32 size, bool init_p);
+  void SlabFree(uint32 offset, uint32 size);
+  SlabPage *SlabNewPage();
+  void ReserveSmallHeap(uint32 offset, uint32 size);
+  void Commit(uint8 **committed, void *from, void *to);
+  bool TryCommit(uint8 **committed, void *from, void *to);
   MemHeader &GetMemHeader(void *memory) {
     uint32 *u32memory = (uint32 *)(memory);
     MemHeader *header_ptr = (MemHeader *)(u32memory - 1);
@@ -236,6 +394,7 @@ class MemoryManager {
 
 #endif
   MemoryChunk *NewMemoryChunk(uint32 offset, uint32 size, MemoryChunk *next);
+  void ReserveMemoryChunks();
   void DeleteMemoryChunk(MemoryChunk *chunk) {
     // add to head of free memory chunk descriptor list
     chunk->next = free_memory_chunk_;
@@ -246,8 +405,15 @@ class MemoryManager {
   // Fixme: These recall functions should not be defined here.
   // Move these to jsobjet.cpp.
   void RecallString(__jsstring *);
+  void RecallRope(__jsstring *);
   void RecallArray_props(__jsvalue *);
   void RecallList(__json_list *);
+  void DrainRecallQueue(uint32 budget);
+  bool DrainAllRecalls();
+  bool FreeInBackground(uint32 offset, uint32 size);
+  void FreeThreadLoop();
+  void ReclaimBackgroundFrees();
+  bool WaitBackgroundFrees();
 
   // function for garbage collection
   void ManageChildObj(__jsobject *obj, ManageType flag);
@@ -256,11 +422,23 @@ class MemoryManager {
   void ManageProp(__jsprop *prop, ManageType flag);
   void ManageObject(__jsobject *obj, ManageType flag);
 #ifdef MARK_CYCLE_ROOTS
-  void AddCycleRootNode(CycleRoot **roots_head, __jsobject *obj);
-  void DeleteCycleRootNode(CycleRoot *root);
-  void ResetCycleRoots();
-  void RecallRoots(CycleRoot *root);
-  void RecallCycle();
+  void AddCycleRoot(__jsobject *obj);
+  void ManageChildEnv(void *envptr, ManageType flag);
+  void ManageCycleNode(__jsobject *node, ManageType flag);
+  bool CycleMarkGray(__jsobject *obj);
+  void CycleUnmark();
+  void CycleScan(__jsobject *obj);
+  void CycleScanBlack(__jsobject *obj);
+  void CycleCollectWhite(__jsobject *obj);
+  void CollectCycles();
+  // Called at safepoints of the interpreter, where every reference it holds
+  // is counted.
+  void MaybeCollectCycles() {
+    if (cycle_roots_.size() >= CYCLE_ROOTS_MAX ||
+        (cycle_alloc_bytes_ >= cycle_trigger_bytes_ && !cycle_roots_.empty())) {
+      CollectCycles();
+    }
+  }
 #else
   void AddObjListNode(__jsobject *obj);
   void DeleteObjListNode(__jsobject *obj);
@@ -293,18 +471,36 @@ class MemoryManager {
   // But the heap-object(or string) is still useful after dec-rf.
   void GCDecRfNoRecall(void *addr) {
     if (IsHeap(addr)) {
-      GetMemHeader(addr).refcount--;
+      RcDec(addr, GetMemHeader(addr));
     }
   }
 
+  void RcOverflowInc(void *addr);
+  void RcOverflowDec(void *addr);
+  void RcInc(void *addr, MemHeader &header) {
+    if (header.refcount < UINT14_MAX - 1)
+      header.refcount++;
+    else
+      RcOverflowInc(addr);
+  }
+  void RcDec(void *addr, MemHeader &header) {
+    if (header.refcount < UINT14_MAX)
+      header.refcount--;
+    else
+      RcOverflowDec(addr);
+  }
+  uint32 GetRefcount(void *addr) {
+    uint32 count = GetMemHeader(addr).refcount;
+    return count < UINT14_MAX ? count : rc_overflow_[addr];
+  }
+
   void GCIncRf(void *addr) {
     if (TurnoffGC())
       return;
     void* true_addr = (void*)((uint64_t)addr & PAYLOAD_MASK);
     if (IsHeap(true_addr)) {
       MemHeader &header = GetMemHeader(true_addr);
-      if(header.refcount < UINT14_MAX)
-        header.refcount++;
+      RcInc(true_addr, header);
 #ifdef MM_DEBUG
 #ifdef MM_RC_STATS
       num_rcinc++;
@@ -389,15 +585,15 @@ class MemoryManager {
 };
 
 extern MemoryManager *memory_manager;  // global instance.
-#ifdef MARK_CYCLE_ROOTS
-extern CycleRoot *cycle_roots;
-#else
 extern bool is_sweep;
-#endif
 
 // C-style interfaces.
+void *VMReserveMemory(uint32 size);
+// Memory comes zeroed unless INIT_P is false, for callers that write all of
+// it; growing a block zeroes only the part added. Fresh heap and blocks the
+// free thread released are known zero and not written again.
 void *VMMallocGC(uint32, MemHeadTag tag = MemHeadAny, bool init_p = true);
-void *VMReallocGC(void *, uint32, uint32);
+void *VMReallocGC(void *, uint32, uint32, bool init_p = true);
 
 static inline void *VMMallocNOGC(uint32 size) {
   return memory_manager->MallocInternal(size);
@@ -426,6 +622,20 @@ static inline void GCDecRfNoRecall(void *p) {
   memory_manager->GCDecRfNoRecall(p);
 }
 
+static inline void GCSafepoint() {
+  if (memory_manager->TurnoffGC())
+    return;
+  if (!memory_manager->recall_queue_.empty()) {
+    memory_manager->DrainRecallQueue(RECALL_PAUSE_WORK);
+  }
+  if (memory_manager->free_outstanding_) {
+    memory_manager->ReclaimBackgroundFrees();
+  }
+#ifdef MARK_CYCLE_ROOTS
+  memory_manager->MaybeCollectCycles();
+#endif
+}
+
 static inline void GCCheckAndDecRf(uint64 val, bool needRc) {
   if (memory_manager->TurnoffGC())
     return;
@@ -457,7 +667,7 @@ static inline void GCCheckAndIncRf(uint64 val, bool needrc) {
 
 #ifdef MEMORY_LEAK_CHECK
 static inline int32_t GCGetRf(void *addr) {
-  return memory_manager->GetMemHeader(addr).refcount;
+  return memory_manager->GetRefcount(addr);
 }
 
 #endif
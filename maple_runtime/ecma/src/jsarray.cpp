@@ -16,6 +16,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <vector>
 #include "jsarray.h"
 #include "jsstring.h"
 #include "jscontext.h"
@@ -32,24 +33,28 @@ __jsobject *__js_new_arr_internal(uint32_t length) {
   __jsobj_set_prototype(arr, JSBUILTIN_ARRAYPROTOTYPE);
   arr->object_type = JSREGULAR_ARRAY;
   // not allocated huge size here
-  __jsvalue *props;
-  if (length > ARRAY_MAXINDEXNUM_INTERNAL) {
-      props = (__jsvalue *)VMMallocGC(sizeof(__jsvalue) * (ARRAY_MAXINDEXNUM_INTERNAL+1));
-    for (int i = 0; i < ARRAY_MAXINDEXNUM_INTERNAL+1; i++)
-      props[i].ptyp = JSTYPE_NONE;
-  } else {
-      props = (__jsvalue *)VMMallocGC(sizeof(__jsvalue) * (length + 1));
-    for (int i = 0; i < length+1; i++)
-      props[i].ptyp = JSTYPE_NONE;
-  }
+  uint32_t capacity = length > ARRAY_MAXINDEXNUM_INTERNAL ? ARRAY_MAXINDEXNUM_INTERNAL + 1 : length;
+  __jsvalue *props = (__jsvalue *)VMMallocGC(__jsarr_block_size(capacity), MemHeadAny, false) + 1;
+  __jsarr_capacity(props) = capacity;
+  __jsarr_kind(props) = length ? JSARR_HOLEY_INT32 : JSARR_PACKED_INT32;
+  for (uint32_t i = 0; i < capacity + 1; i++)
+    props[i] = __none_value();
   arr->shared.array_props = props;
   props[0] = length > INT32_MAX ? __double_value((double)length) : __number_value(length);
   return arr;
 }
 
+__jsobject *__js_new_arr_packed(uint32_t length) {
+  __jsobject *arr = __js_new_arr_internal(length);
+  if (length <= ARRAY_MAXINDEXNUM_INTERNAL) {
+    __jsarr_kind(arr->shared.array_props) = JSARR_PACKED_INT32;
+  }
+  return arr;
+}
+
 // ecma 15.4.2.1
 __jsobject *__js_new_arr_elems(__jsvalue *items, uint32_t length) {
-  __jsobject *arr = __js_new_arr_internal(length);
+  __jsobject *arr = __js_new_arr_packed(length);
   __jsvalue *array_elems = arr->shared.array_props;
   for (uint32_t i = 0; i < length; i++) {
 //    __jsvalue itVt = memory_manager->EmulateLoad(((uint64_t *)items->x.ptr + i), items->ptyp);
@@ -64,10 +69,11 @@ __jsobject *__js_new_arr_elems(__jsvalue *items, uint32_t length) {
 // different from the function above which will load items from memory that
 // is iassigned to value
 __jsobject *__js_new_arr_elems_direct(__jsvalue *items, uint32_t length) {
-  __jsobject *arr = __js_new_arr_internal(length);
+  __jsobject *arr = __js_new_arr_packed(length);
   __jsvalue *array_elems = arr->shared.array_props;
   for (uint32_t i = 0; i < length; i++) {
     GCCheckAndIncRf(items[i].x.asbits, IsNeedRc(items[i].ptyp));
+    __jsarr_note_store(array_elems, &items[i]);
     array_elems[i + 1] = items[i];
   }
   return arr;
@@ -179,31 +185,32 @@ __jsvalue __jsarr_pt_toLocaleString(__jsvalue *this_array) {
   // ecma 15.4.4.3.4
   // TODO:: sep value could get from host environment, now use comma
   __jsstring *sep = __jsstr_get_builtin(JSBUILTIN_STRING_COMMA_CHAR);
-  __jsstring *r = NULL;
-  // ecma 15.4.4.3.6-7
-  __jsvalue elem0 = __jsobj_internal_Get(o, (uint32_t)0);
-  r = __jsarr_ElemToLocaleString(&elem0);
-  // ecma 15.4.4.3.9 && 10
-  for (uint32_t k = 1; k < len; k++) {
+  __jsstr_builder r;
+  // ecma 15.4.4.3.6-10
+  for (uint32_t k = 0; k < len; k++) {
+    if (k > 0) {
+      __jsstr_builder_append(&r, sep);
+    }
     __jsvalue elem = __jsobj_internal_Get(o, k);
     __jsstring* cur = __jsarr_ElemToLocaleString(&elem);
-    __jsstring* prev = r;
-    r = __jsstr_concat_3(prev, sep, cur);
+    __jsstr_builder_append(&r, cur);
     memory_manager->RecallString(cur);
-    memory_manager->RecallString(prev);
   }
   GCDecRf(sep);
   // ecma 15.4.4.3.11
-  return __string_value(r);
+  return __string_value(__jsstr_builder_finish(&r));
 }
 
-// Helper for __jsarr_pt_concat, copy values from src to dest.
+// Helper for __jsarr_pt_concat, copy values from src to the elements of arr
+// from index next on.
 // If the src value is not JSARRAY, it is a simple value copy and return 1,
 // Else src mustbe JSARRAY, get every element of src and put them to dest,
 // return the length property of src.
-uint32_t __jsarr_helper_copy_values(__jsvalue *dest, __jsvalue *src) {
+uint32_t __jsarr_helper_copy_values(__jsvalue *arr, uint32_t next, __jsvalue *src) {
+  __jsvalue *dest = &arr[next + 1];
   if (!__is_js_array(src)) {
     GCCheckAndIncRf(src->x.asbits, IsNeedRc(src->ptyp));
+    __jsarr_note_store(arr, src);
     *dest = *src;
     return 1;
   } else {
@@ -212,6 +219,7 @@ uint32_t __jsarr_helper_copy_values(__jsvalue *dest, __jsvalue *src) {
     for (uint32_t i = 0; i < len; i++) {
       dest[i] = __jsarr_GetElem(o, i);
       GCCheckAndIncRf(dest[i].x.asbits, IsNeedRc(dest[i].ptyp));
+      __jsarr_note_store(arr, &dest[i]);
     }
     return len;
   }
@@ -237,12 +245,12 @@ __jsvalue __jsarr_pt_concat(__jsvalue *this_array, __jsvalue *items, uint32_t si
     }
   }
   // ecma 15.4.4.4 step 2~5.
-  __jsobject *a = __js_new_arr_internal(len);
-  __jsvalue *dest = &(a->shared.array_props[1]);
-  uint32_t next = __jsarr_helper_copy_values(dest, this_array);
+  __jsobject *a = __js_new_arr_packed(len);
+  __jsvalue *dest = a->shared.array_props;
+  uint32_t next = __jsarr_helper_copy_values(dest, 0, this_array);
   for (uint32_t i = 0; i < size; i++) {
     __jsvalue e = items[i];
-    next += __jsarr_helper_copy_values(&dest[next], &e);
+    next += __jsarr_helper_copy_values(dest, next, &e);
   }
   return __object_value(a);
 }
@@ -268,15 +276,13 @@ __jsvalue __jsarr_pt_join(__jsvalue *this_array, __jsvalue *separator) {
       __jsstring *empty = __jsstr_get_builtin(JSBUILTIN_STRING_EMPTY);
       return __string_value(empty);
     }
-    __jsvalue element0 = __jsarr_GetRegularElem(o, array, 0);
-    __jsstring *r = __jsarr_ElemToString(&element0);
-    for (uint32_t k = 1; k < len; k++) {
+    __jsstr_builder r;
+    for (uint32_t k = 0; k < len; k++) {
       __jsvalue element = __jsarr_GetRegularElem(o, array, k);
-      __jsstring *cur = r;
-      r = __jsarr_JoinOnce(&element, cur, sep);
+      __jsarr_JoinOnce(&r, &element, k > 0 ? sep : NULL);
     }
     GCDecRf(sep);
-    return __string_value(r);
+    return __string_value(__jsstr_builder_finish(&r));
   }
   // slow path for generic array
   else {
@@ -287,19 +293,15 @@ __jsvalue __jsarr_pt_join(__jsvalue *this_array, __jsvalue *separator) {
       __jsstring *empty = __jsstr_get_builtin(JSBUILTIN_STRING_EMPTY);
       return __string_value(empty);
     }
-    // ecma 15.4.4.5 step 7.
-    __jsvalue element0 = __jsobj_internal_Get(o, (uint32_t)0);
-    // ecma 15.4.4.5 step 8.
-    __jsstring *r = __jsarr_ElemToString(&element0);
-    // ecma 15.4.4.5 step 9~10.
-    for (uint32_t k = 1; k < len; k++) {
+    // ecma 15.4.4.5 step 7~10.
+    __jsstr_builder r;
+    for (uint32_t k = 0; k < len; k++) {
       __jsvalue element = __jsobj_internal_Get(o, k);
-      __jsstring *cur = r;
-      r = __jsarr_JoinOnce(&element, cur, sep);
+      __jsarr_JoinOnce(&r, &element, k > 0 ? sep : NULL);
     }
     // ecma 15.4.4.5 step 11.
     GCDecRf(sep);
-    return __string_value(r);
+    return __string_value(__jsstr_builder_finish(&r));
   }
 }
 
@@ -367,7 +369,7 @@ __jsvalue __jsarr_pt_push(__jsvalue *this_array, __jsvalue *items, uint32_t size
   // fast path for regular array
   if (o->object_type == JSREGULAR_ARRAY) {
     __jsvalue *array = o->shared.array_props;
-    o->shared.array_props = __jsarr_RegularRealloc(array, n, n + size);
+    o->shared.array_props = __jsarr_RegularRealloc(array, n, n + size, true);
     array = o->shared.array_props;
     for (uint32_t i = 0; i < size; i++) {
       __set_regular_elem(array, i + n, &items[i]);
@@ -397,7 +399,7 @@ __jsvalue __jsarr_pt_push(__jsvalue *this_array, __jsvalue *items, uint32_t size
   return __double_value(n);
 }
 
-// Helper for __jsarr_pt_reverse and __jsarr_pt_sort
+// Helper for __jsarr_pt_reverse
 void __jsarr_helper_ExchangeElem(__jsobject *arr, uint32_t idx1, uint32_t idx2) {
   __jsvalue elem1, elem2;
   bool exist1 = __jsobj_helper_HasPropertyAndGet(arr, idx1, &elem1);
@@ -565,13 +567,15 @@ __jsvalue __jsarr_pt_slice(__jsvalue *this_array, __jsvalue *start, __jsvalue *e
   if (o->object_type == JSREGULAR_ARRAY) {
     __jsvalue *array = o->shared.array_props;
     uint32_t new_len = k < final ? (final - k) : 0;
-    __jsobject *a = __js_new_arr_internal(new_len);
+    __jsobject *a = __js_new_arr_packed(new_len);
     __jsvalue *new_array = a->shared.array_props;
     uint32_t n = 0;
     while (k < final) {
       __jsvalue k_elem = __jsarr_GetRegularElem(o, array, k);
       if (!__is_none(&k_elem)) {
         __set_regular_elem(new_array, n, &k_elem);
+      } else {
+        __jsarr_kind(new_array) |= JSARR_HOLEY;
       }
       k++;
       n++;
@@ -606,60 +610,127 @@ __jsvalue __jsarr_pt_slice(__jsvalue *this_array, __jsvalue *start, __jsvalue *e
   }
 }
 
-// Helper function for __jsarr_pt_sort.
-static int32_t __jsarr_SortCompare(__jsobject *obj, __jsvalue *cmpfn, uint32_t idx1, uint32_t idx2) {
-  __jsvalue j, k;
-  bool hasj = __jsobj_helper_HasPropertyAndGet(obj, idx1, &j);
-  bool hask = __jsobj_helper_HasPropertyAndGet(obj, idx2, &k);
-  // ecma 15.4.4.11 step 5.
-  if (!hasj && !hask) {
-    return 0;
-  }
-  // ecma 15.4.4.11 step 6.
-  if (!hasj) {
-    return 1;
-  }
-  // ecma 15.4.4.11 step 7.
-  if (!hask) {
-    return -1;
-  }
-  // ecma 15.4.4.11 step 10.
-  if (__is_undefined(&j) && __is_undefined(&k)) {
-    return 0;
+// An element of an array being sorted. The key is the one of the default
+// comparator: a number ordered like the element's string, or the string.
+struct __jsarr_sort_item {
+  __jsvalue value;
+  union {
+    uint64_t num;
+    __jsstring *str;
+  } key;
+};
+
+// The elements taken out of an array by __jsarr_pt_sort. The buffer holds a
+// reference on each of them and on the strings made for keys, so that they
+// survive a comparator modifying the array, and drops them however the sort
+// ends.
+struct __jsarr_sort_buffer {
+  std::vector<__jsarr_sort_item> items;
+  std::vector<__jsstring *> keys;
+  ~__jsarr_sort_buffer() {
+    for (uint32_t i = 0; i < items.size(); i++) {
+      GCCheckAndDecRf(items[i].value.x.asbits, IsNeedRc(items[i].value.ptyp));
+    }
+    for (uint32_t i = 0; i < keys.size(); i++) {
+      GCDecRf(keys[i]);
+    }
   }
-  // ecma 15.4.4.11 step 11.
-  if (__is_undefined(&j)) {
-    return 1;
+};
+
+// Key of the default comparator for an int32 element. "-" sorts before the
+// digits and a prefix before the longer strings, so the key is the sign
+// followed by the (up to 10) digits of the magnitude in base 11, with 0 for
+// past the end and digit + 1 for a digit.
+static uint64_t __jsarr_sort_int_key(int32_t i) {
+  uint64_t magnitude = i < 0 ? -(int64_t)i : i;
+  uint8_t digits[10];
+  uint32_t n = 0;
+  do {
+    digits[n++] = magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+  uint64_t key = i < 0 ? 0 : 1;
+  for (uint32_t k = 0; k < 10; k++) {
+    key = key * 11 + (k < n ? digits[n - 1 - k] + 1 : 0);
+  }
+  return key;
+}
+
+struct __jsarr_sort_by_num {
+  int32_t operator()(const __jsarr_sort_item &a, const __jsarr_sort_item &b) {
+    return a.key.num < b.key.num ? -1 : (a.key.num > b.key.num ? 1 : 0);
   }
-  // ecma 15.4.4.11 step 12.
-  if (__is_undefined(&k)) {
-    return -1;
+};
+
+struct __jsarr_sort_by_str {
+  int32_t operator()(const __jsarr_sort_item &a, const __jsarr_sort_item &b) {
+    return __jsstr_compare(a.key.str, b.key.str);
   }
-  // ecma 15.4.4.11 step 13.
-  if (!__is_undefined(cmpfn)) {
-     if (!__js_IsCallable(cmpfn)) {
-       MAPLE_JS_TYPEERROR_EXCEPTION();
-     }
-    __jsobject *func = __jsval_to_object(cmpfn);
-    __jsvalue arg_list[2] = { j, k };
+};
+
+// ecma 15.4.4.11 step 13, call comparefn.
+struct __jsarr_sort_by_fn {
+  __jsobject *func;
+  int32_t operator()(const __jsarr_sort_item &a, const __jsarr_sort_item &b) {
+    __jsvalue arg_list[2] = { a.value, b.value };
     __jsvalue undefined = __undefined_value();
     __jsvalue res = __jsfun_internal_call(func, &undefined, arg_list, 2);
-    return __jsval_to_number(&res);
-  }
-  // ecma 15.4.4.11 step 14.
-  __jsstring *x_string = __js_ToString(&j);
-  // ecma 15.4.4.11 step 15.
-  __jsstring *y_string = __js_ToString(&k);
-  ;
-  // ecma 15.4.4.11 step 16~18.
-  int32_t res = __jsstr_compare(x_string, y_string);
-  if (!__is_string(&j)) {
-    memory_manager->RecallString(x_string);
-  }
-  if (!__is_string(&k)) {
-    memory_manager->RecallString(y_string);
-  }
-  return res;  // compare according to what rule?
+    if (!__is_double(&res)) {
+      // Only the sign matters: don't truncate to an int32, that maps "-0.5"
+      // to 0 and the infinities to 0 as well.
+      bool convertible = false;
+      res = __js_ToNumber2(&res, convertible);
+    }
+    if (__is_infinity(&res)) {
+      return __is_neg_infinity(&res) ? -1 : 1;
+    }
+    if (!__is_number(&res) && !__is_double(&res)) {
+      // NaN, or undefined from an object converting to it.
+      return 0;
+    }
+    double d = __jsval_to_double(&res);
+    return d > 0 ? 1 : (d < 0 ? -1 : 0);
+  }
+};
+
+#define JSARR_SORT_INSERTION_MAX 16
+
+// Stable merge sort of the N items at A, TMP has room for N / 2 items. Runs
+// already in order cost a single comparison. Only relies on CMP to return,
+// it may be inconsistent.
+template <typename Cmp>
+static void __jsarr_merge_sort(__jsarr_sort_item *a, __jsarr_sort_item *tmp, uint32_t n, Cmp &cmp) {
+  if (n <= JSARR_SORT_INSERTION_MAX) {
+    for (uint32_t i = 1; i < n; i++) {
+      __jsarr_sort_item x = a[i];
+      uint32_t j = i;
+      for (; j > 0 && cmp(a[j - 1], x) > 0; j--) {
+        a[j] = a[j - 1];
+      }
+      a[j] = x;
+    }
+    return;
+  }
+  uint32_t mid = n / 2;
+  __jsarr_merge_sort(a, tmp, mid, cmp);
+  __jsarr_merge_sort(a + mid, tmp, n - mid, cmp);
+  if (cmp(a[mid - 1], a[mid]) <= 0) {
+    return;
+  }
+  std::copy(a, a + mid, tmp);
+  uint32_t i = 0, j = mid, k = 0;
+  while (i < mid && j < n) {
+    a[k++] = cmp(a[j], tmp[i]) < 0 ? a[j++] : tmp[i++];
+  }
+  while (i < mid) {
+    a[k++] = tmp[i++];
+  }
+}
+
+template <typename Cmp>
+static void __jsarr_sort_items(std::vector<__jsarr_sort_item> &items, Cmp cmp) {
+  std::vector<__jsarr_sort_item> tmp(items.size() / 2);
+  __jsarr_merge_sort(items.data(), tmp.data(), items.size(), cmp);
 }
 
 // ecma 15.4.4.11
@@ -667,15 +738,79 @@ __jsvalue __jsarr_pt_sort(__jsvalue *this_array, __jsvalue *comparefn) {
   __jsobject *obj = __jsval_to_object(this_array);
   uint64_t len = __jsobj_helper_get_lengthsize(obj);
   if (len <= 0) return __object_value(obj);
+  if (!__is_undefined(comparefn) && !__js_IsCallable(comparefn)) {
+    MAPLE_JS_TYPEERROR_EXCEPTION();
+  }
+
+  // Take the elements out once. Nonexistent elements (step 5~7) and undefined
+  // ones (step 10~12) go to the end, they don't need to be compared.
+  __jsarr_sort_buffer buffer;
+  uint32_t num_undefined = 0;
+  bool all_int = true;
+  bool all_string = true;
+  for (uint32_t i = 0; i < len; i++) {
+    __jsvalue v;
+    bool exist;
+    if (obj->object_type == JSREGULAR_ARRAY && i < ARRAY_MAXINDEXNUM_INTERNAL &&
+        !__is_none(&obj->shared.array_props[i + 1])) {
+      v = obj->shared.array_props[i + 1];
+      exist = true;
+    } else {
+      exist = __jsobj_helper_HasPropertyAndGet(obj, i, &v);
+    }
+    if (!exist) {
+      continue;
+    }
+    if (__is_undefined(&v)) {
+      num_undefined++;
+      continue;
+    }
+    all_int = all_int && __is_number(&v);
+    all_string = all_string && __is_string(&v);
+    GCCheckAndIncRf(v.x.asbits, IsNeedRc(v.ptyp));
+    __jsarr_sort_item item;
+    item.value = v;
+    item.key.str = NULL;
+    buffer.items.push_back(item);
+  }
+  std::vector<__jsarr_sort_item> &items = buffer.items;
 
-  // Ignored the 4 cases that the behaviour of sort is implementation defined???
-  // Use the bubble sort
-  for (uint32_t m = 0; m < len - 1; m++)
-    for (uint32_t n = 0; n < len - 1 - m; n++) {
-      if (__jsarr_SortCompare(obj, comparefn, n, n + 1) > 0) {
-        __jsarr_helper_ExchangeElem(obj, n, n + 1);
+  if (!__is_undefined(comparefn)) {
+    __jsarr_sort_by_fn cmp = { __jsval_to_object(comparefn) };
+    __jsarr_sort_items(items, cmp);
+  } else if (all_int) {
+    // ecma 15.4.4.11 step 14~18 without making the strings.
+    for (uint32_t i = 0; i < items.size(); i++) {
+      items[i].key.num = __jsarr_sort_int_key(__jsval_to_int32(&items[i].value));
+    }
+    __jsarr_sort_items(items, __jsarr_sort_by_num());
+  } else {
+    // ecma 15.4.4.11 step 14~18, with each string made once.
+    for (uint32_t i = 0; i < items.size(); i++) {
+      if (all_string || __is_string(&items[i].value)) {
+        items[i].key.str = __jsval_to_string(&items[i].value);
+      } else {
+        __jsstring *str = __js_ToString(&items[i].value);
+        GCIncRf(str);
+        buffer.keys.push_back(str);
+        items[i].key.str = str;
       }
     }
+    __jsarr_sort_items(items, __jsarr_sort_by_str());
+  }
+
+  // Write the result back once.
+  uint32_t k = 0;
+  for (uint32_t i = 0; i < items.size(); i++) {
+    __jsobj_internal_Put(obj, k++, &items[i].value, true);
+  }
+  __jsvalue undefined = __undefined_value();
+  for (uint32_t i = 0; i < num_undefined; i++) {
+    __jsobj_internal_Put(obj, k++, &undefined, true);
+  }
+  for (; k < len; k++) {
+    __jsobj_internal_Delete(obj, k);
+  }
   return __object_value(obj);
 }
 
@@ -767,7 +902,7 @@ __jsvalue __jsarr_pt_unshift(__jsvalue *this_array, __jsvalue *items, uint32_t s
   // fast path for regular array
   if (o->object_type == JSREGULAR_ARRAY) {
     __jsvalue *array = o->shared.array_props;
-    o->shared.array_props = __jsarr_RegularRealloc(array, len, len + size);
+    o->shared.array_props = __jsarr_RegularRealloc(array, len, len + size, true);
     array = o->shared.array_props;
     while (k > 0) {
       __jsarr_internal_MoveElem(o, array, k + size - 1, k - 1);
@@ -796,6 +931,39 @@ __jsvalue __jsarr_pt_unshift(__jsvalue *this_array, __jsvalue *items, uint32_t s
   return __number_value(len + size);
 }
 
+#define JSARR_FIND_UNKNOWN (-2)
+
+// Search the elements of a packed numeric array from index K to END, not
+// included, by STEP, for one strictly equal to V (ecma 11.9.6). Return its
+// index, -1 if there is none, or JSARR_FIND_UNKNOWN if the elements have to
+// be compared one by one.
+static int64_t __jsarr_find_packed(__jsvalue *arr, __jsvalue *v, int64_t k, int64_t end, int64_t step) {
+  uint8_t kind = __jsarr_kind(arr);
+  if ((kind & JSARR_HOLEY) || !__jsarr_is_numeric(arr)) {
+    return JSARR_FIND_UNKNOWN;
+  }
+  switch (v->ptyp) {
+    case JSTYPE_NUMBER:
+      if (kind == JSARR_PACKED_INT32) {
+        int32_t n = __jsval_to_number(v);
+        for (; step > 0 ? k < end : k > end; k += step) {
+          if (arr[k + 1].x.i32 == n) {
+            return k;
+          }
+        }
+        return -1;
+      }
+      return JSARR_FIND_UNKNOWN;
+    case JSTYPE_DOUBLE:
+    case JSTYPE_NAN:
+    case JSTYPE_INFINITY:
+      return JSARR_FIND_UNKNOWN;
+    default:
+      // Only numbers are strictly equal to numbers.
+      return -1;
+  }
+}
+
 // ecma 15.4.4.14
 __jsvalue __jsarr_pt_indexOf(__jsvalue *this_array, __jsvalue *arg_list, uint32_t argNum) {
   // ecma 15.4.4.14 step 1.
@@ -832,6 +1000,10 @@ __jsvalue __jsarr_pt_indexOf(__jsvalue *this_array, __jsvalue *arg_list, uint32_
   // fast path for regular array
   if (o->object_type == JSREGULAR_ARRAY) {
     __jsvalue *array = o->shared.array_props;
+    int64_t found = __jsarr_find_packed(array, searchElement, k, len, 1);
+    if (found != JSARR_FIND_UNKNOWN) {
+      return __number_value(found);
+    }
     while (k < len) {
       __jsvalue element_k = __jsarr_GetRegularElem(o, array, k);
       if (!__is_none(&element_k)) {
@@ -923,6 +1095,10 @@ __jsvalue __jsarr_pt_lastIndexOf(__jsvalue *this_array, __jsvalue *arg_list, uin
   // fast path for regular array
   if (o->object_type == JSREGULAR_ARRAY) {
     __jsvalue *array = o->shared.array_props;
+    int64_t found = __jsarr_find_packed(array, searchElement, k, -1, -1);
+    if (found != JSARR_FIND_UNKNOWN) {
+      return __number_value(found);
+    }
     while (k >= 0) {
       __jsvalue element_k = __jsarr_GetRegularElem(o, array, k);
       if (!__is_none(&element_k)) {
@@ -1495,6 +1671,7 @@ void __set_generic_elem(__jsobject *arr, uint32_t index, __jsvalue *v) {
 }
 
 void __set_regular_elem(__jsvalue *arr, uint32_t index, __jsvalue *v) {
+  __jsarr_note_store(arr, v);
 #ifndef RC_NO_MMAP
   memory_manager->UpdateGCReference(&arr[index + 1].x.payload.ptr, JsvalToMval(*v));
 #else
@@ -1534,17 +1711,23 @@ __jsstring *__jsarr_ElemToString(__jsvalue *elem) {
   }
 }
 
-__jsstring *__jsarr_JoinOnce(__jsvalue *elem, __jsstring *cur, __jsstring *sep) {
+// Append sep, unless NULL, and the string value of elem to builder.
+void __jsarr_JoinOnce(__jsstr_builder *builder, __jsvalue *elem, __jsstring *sep) {
+  if (sep) {
+    __jsstr_builder_append(builder, sep);
+  }
   __jsstring *next = __jsarr_ElemToString(elem);
-  __jsstring *r = __jsstr_concat_3(cur, sep, next);
-  memory_manager->RecallString(cur);
+  __jsstr_builder_append(builder, next);
   memory_manager->RecallString(next);
-  return r;
 }
 
 __jsvalue __jsarr_GetRegularElem(__jsobject *o, __jsvalue *arr, uint32_t idx) {
   // uese idx + 1 because arr[0] is the length of this array
   MAPLE_JS_ASSERT(o->object_type == JSREGULAR_ARRAY);
+  // A packed array stores all its elements, none of them is looked up.
+  if (!(__jsarr_kind(arr) & JSARR_HOLEY)) {
+    return arr[idx + 1];
+  }
   if (idx <= ARRAY_MAXINDEXNUM_INTERNAL) {
     __jsvalue elem = arr[idx + 1];
     if (!__is_none(&elem)) {
@@ -1573,40 +1756,75 @@ __jsvalue __jsarr_GetElem(__jsobject *o, uint32_t idx) {
   return result;
 }
 
-__jsvalue *__jsarr_RegularRealloc(__jsvalue *arr, uint32_t old_len, uint32_t new_len) {
-  uint32_t old_size = old_len + 1;
-  uint32_t new_size = new_len + 1;
-#ifndef RC_NO_MMAP
-  uint32_t old_addr[old_size], new_addr[new_size];
-#endif
-  if (new_len < old_len) {
-    for (uint32_t i = new_size; i < old_size; i++) {
+// Set the length of a regular array to NEW_LEN. The elements only move when
+// the array outgrows its capacity or shrinks to a quarter of it.
+__jsvalue *__jsarr_RegularRealloc(__jsvalue *arr, uint32_t old_len, uint32_t new_len, bool filled) {
+  uint32_t capacity = __jsarr_capacity(arr);
+  uint32_t old_stored = __jsarr_stored_length(arr, old_len);
+  // The caller stores up to NEW_LEN when FILLED, otherwise the added
+  // elements are holes, and those past ARRAY_MAXINDEXNUM_INTERNAL are not
+  // stored.
+  uint32_t needed = new_len;
+  if (!filled && needed > ARRAY_MAXINDEXNUM_INTERNAL + 1) {
+    needed = ARRAY_MAXINDEXNUM_INTERNAL + 1;
+  }
+  if (needed > ARRAY_MAX_CAPACITY) {
+    MAPLE_JS_RANGEERROR_EXCEPTION();
+  }
+  if (new_len < old_stored) {
+    bool numeric = __jsarr_is_numeric(arr);
+    for (uint32_t i = new_len + 1; i < old_stored + 1; i++) {
+      if (!numeric) {
 #ifdef MACHINE64
-      GCCheckAndDecRf(arr[i].x.asbits, IsNeedRc(arr[i].ptyp));
+        GCCheckAndDecRf(arr[i].x.asbits, IsNeedRc(arr[i].ptyp));
 #else
-      GCDecRf(arr[i].x.payload.ptr);
+        GCDecRf(arr[i].x.payload.ptr);
 #endif
+      }
+      arr[i] = __none_value();
+    }
+    old_stored = new_len;
+  }
+  if (new_len == 0) {
+    __jsarr_kind(arr) = JSARR_PACKED_INT32;
+  } else if (new_len > old_stored && !filled) {
+    __jsarr_kind(arr) |= JSARR_HOLEY;
+  }
+  uint32_t new_capacity = capacity;
+  if (needed > capacity) {
+    new_capacity = capacity > ARRAY_MAX_CAPACITY / 2 ? ARRAY_MAX_CAPACITY : capacity * 2;
+    if (new_capacity < needed) {
+      new_capacity = needed;
     }
+    if (new_capacity < ARRAY_MIN_CAPACITY) {
+      new_capacity = ARRAY_MIN_CAPACITY;
+    }
+  } else if (new_len < capacity / 4 && capacity > ARRAY_MIN_CAPACITY) {
+    new_capacity = new_len * 2 < ARRAY_MIN_CAPACITY ? ARRAY_MIN_CAPACITY : new_len * 2;
   }
+  __jsvalue *new_arr = arr;
+  if (new_capacity != capacity) {
 #ifndef RC_NO_MMAP
-  for (uint32_t i = 0; i < old_size; i++) {
-    old_addr[i] = (uint32_t)(&arr[i].x.payload.ptr);
-  }
+    uint32_t old_size = old_stored + 1;
+    uint32_t old_addr[old_size], new_addr[old_size];
+    for (uint32_t i = 0; i < old_size; i++) {
+      old_addr[i] = (uint32_t)(&arr[i].x.payload.ptr);
+    }
 #endif
-  __jsvalue *new_arr = (__jsvalue *)VMReallocGC(arr, (old_size) * sizeof(__jsvalue), (new_size) * sizeof(__jsvalue));
-  if (new_len > old_len) {
-    for (uint32_t i = old_len; i < new_len; i++) {
-      __jsvalue none_val = __none_value();
-      __set_regular_elem(new_arr, i, &none_val);
+    new_arr = (__jsvalue *)VMReallocGC(arr - 1, __jsarr_block_size(capacity), __jsarr_block_size(new_capacity), false) + 1;
+    __jsarr_capacity(new_arr) = new_capacity;
+    // The added elements are not initialized, there is no old value to release.
+    for (uint32_t i = capacity + 1; i < new_capacity + 1; i++) {
+      new_arr[i] = __none_value();
     }
-  }
-  new_arr[0] = __number_value(new_len);
 #ifndef RC_NO_MMAP
-  for (uint32_t i = 0; i < new_size; i++) {
-    new_addr[i] = (uint32_t)(&new_arr[i].x.payload.ptr);
-  }
-  memory_manager->UpdateAddrMap(old_addr, new_addr, old_size, new_size);
+    for (uint32_t i = 0; i < old_size; i++) {
+      new_addr[i] = (uint32_t)(&new_arr[i].x.payload.ptr);
+    }
+    memory_manager->UpdateAddrMap(old_addr, new_addr, old_size, old_size);
 #endif
+  }
+  new_arr[0] = new_len > INT32_MAX ? __double_value((double)new_len) : __number_value(new_len);
   return new_arr;
 }
 
@@ -76,23 +76,14 @@ __js_encode_Ucs4ToUtf8Char(uint8_t *utf8Buffer, uint32_t ucs4Char)
 }
 
 static bool
-Encode(__jsstring *src_js_str, char *result, const bool *unescapedSet,
+Encode(__jsstring *src_js_str, __jsstr_builder *result, const bool *unescapedSet,
        const bool *unescapedSet2, bool component)
 {
     size_t length = __jsstr_get_length(src_js_str);
     if (length == 0) {
-        result[0] = '\0';
         return true;
     }
 
-    std::string strb;
-    try{
-      strb.reserve((length*3));  // Alloc string memory for 3x length for char expansion
-    } catch( std::exception& ) { // frees automatically when strb goes out of scope
-      return false;
-      //return err_code;         // Eventually support err code on failure
-    }
-
 #ifdef DEBUG_E
   for (int k = 0; k < 10; k++){
     printf("{%c}", (char)__jsstr_get_char(src_js_str, k));
@@ -107,9 +98,9 @@ Encode(__jsstring *src_js_str, char *result, const bool *unescapedSet,
 #ifdef DEBUG_E
           printf("Regular - {%c}{%d}", (char)c, component);
 #endif
-          strb += hexBuf[0];
-          strb += hexchars[(unsigned char)c >> 4];
-          strb += hexchars[(unsigned char)c & 0xF];
+          __jsstr_builder_append_char(result, hexBuf[0]);
+          __jsstr_builder_append_char(result, hexchars[(unsigned char)c >> 4]);
+          __jsstr_builder_append_char(result, hexchars[(unsigned char)c & 0xF]);
         } else
         if (c < 128  //Add another MAP for these
 		&& (c !=93) && (c !=91) && (c !=94) && (c !=34) 
@@ -119,15 +110,15 @@ Encode(__jsstring *src_js_str, char *result, const bool *unescapedSet,
 #ifdef DEBUG_E
           printf("Unescaped - {%c}{%d}", (char)c, component);
 #endif
-          strb+=c;
+          __jsstr_builder_append_char(result, c);
         } else
         if (c < 128 ) {
 #ifdef DEBUG_E
           printf("Regular - {%c}{%d}", (char)c, component);
 #endif
-          strb += hexBuf[0];
-          strb += hexchars[(unsigned char)c >> 4];
-          strb += hexchars[(unsigned char)c & 0xF];
+          __jsstr_builder_append_char(result, hexBuf[0]);
+          __jsstr_builder_append_char(result, hexchars[(unsigned char)c >> 4]);
+          __jsstr_builder_append_char(result, hexchars[(unsigned char)c & 0xF]);
         } else {
             if ((c <= 0xDFFF) && (c >= 0xDC00)) {
                 MAPLE_JS_URIERROR_EXCEPTION();
@@ -150,13 +141,12 @@ Encode(__jsstring *src_js_str, char *result, const bool *unescapedSet,
             for (size_t j = 0; j < char_len; j++) {
                 hexBuf[1] = hexchars[utf8buf[j] >> 4];
                 hexBuf[2] = hexchars[utf8buf[j] & 0xf];
-                strb+=hexBuf[0];
-                strb+=hexBuf[1];
-                strb+=hexBuf[2];
+                __jsstr_builder_append_char(result, hexBuf[0]);
+                __jsstr_builder_append_char(result, hexBuf[1]);
+                __jsstr_builder_append_char(result, hexBuf[2]);
             }
         }
     }
-    strcpy(result, strb.c_str());
 
     return true;
 }
@@ -263,17 +253,13 @@ Decode(__jsstring *src_js_str, __jsstring *&result, const bool *reservedSet, con
     }
 
     mjs_char c;
-    bool highByteZero = true;
-    bool cvtOk = true;
-    std::string strb;
-    std::u16string utf16;
+    __jsstr_builder strb;
 
-    // replace '%xx' patterns with corresponding 8 bit binary
+    // replace '%xx' patterns with the code units they encode
     int n;    // URI escape sequence length
     for (size_t i = 0; i < length; i++) {
         c = __jsstr_get_char(src_js_str, i);
         if (c == '%') {
-            size_t start = i;
             if ((i + 2) >= length)
                 goto report_bad_uri;
             if (!MJS_ISHEX(__jsstr_get_char(src_js_str, i+1)) || !MJS_ISHEX(__jsstr_get_char(src_js_str, i+2)))
@@ -291,6 +277,7 @@ Decode(__jsstring *src_js_str, __jsstring *&result, const bool *reservedSet, con
               if (i + 3 * (n - 1) >= length)
                   goto report_bad_uri;
 
+              uint32_t v = B & ((1 << (7 - n)) - 1);
               for (int j = 1; j <= n; j++) {
                   if (__jsstr_get_char(src_js_str, i) != '%')
                       goto report_bad_uri;
@@ -299,50 +286,41 @@ Decode(__jsstring *src_js_str, __jsstring *&result, const bool *reservedSet, con
                   B = MJS_UNHEX(__jsstr_get_char(src_js_str, i+1)) * 16 + MJS_UNHEX(__jsstr_get_char(src_js_str, i+2));
                   if (j>1 && (B & 0xC0) != 0x80)  // subsequent bytes must start with binary 10 i.e. 0b10xxxxxx
                       goto report_bad_uri;
+                  if (j > 1)
+                      v = (v << 6) | (B & 0x3F);
                   i =  (j==n) ? i+2 : i+3;        // if last byte in sequence, adjust for i increment in outermost for loop
-                  strb += B;
+              }
+              // reject overlong forms, surrogates and values beyond unicode
+              static const uint32_t min_v[5] = {0, 0, 0x80, 0x800, 0x10000};
+              if (v < min_v[n] || (v >= 0xD800 && v <= 0xDFFF) || v > 0x10FFFF)
+                  goto report_bad_uri;
+              if (v < 0x10000) {
+                  __jsstr_builder_append_char(&strb, (mjs_char)v);
+              } else {
+                  v -= 0x10000;
+                  __jsstr_builder_append_char(&strb, (mjs_char)(0xD800 + (v >> 10)));
+                  __jsstr_builder_append_char(&strb, (mjs_char)(0xDC00 + (v & 0x3FF)));
               }
 
             } else {
               // std ascii char - check for rsvd char
               if (!component && reservedSet && reservedSet[B]) {
                 // if rsvd char, keep ascii string '%XX'
-                strb += c;
-                strb += __jsstr_get_char(src_js_str, i+1);
-                strb += __jsstr_get_char(src_js_str, i+2);
+                __jsstr_builder_append_char(&strb, c);
+                __jsstr_builder_append_char(&strb, __jsstr_get_char(src_js_str, i+1));
+                __jsstr_builder_append_char(&strb, __jsstr_get_char(src_js_str, i+2));
               } else {
-                strb += B;
+                __jsstr_builder_append_char(&strb, B);
               }
               i += 2;
               continue;
             }
         } else {
-            strb+=c;
+            __jsstr_builder_append_char(&strb, c);
         }
     }
 
-    try {
-      utf16 = std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t>{}.from_bytes(strb.data());
-    }
-    catch (std::range_error) {
-      cvtOk = false;
-      MAPLE_JS_URIERROR_EXCEPTION();
-    }
-    if (cvtOk) {
-      for (uint32_t i=0; i<utf16.length(); i++) {
-        if (utf16.data()[i] >= 256) {
-          highByteZero = false;
-        }
-      }
-    } else {
-      return false;
-    }
-    // allocate and setup return jsstring
-    result = __js_new_string_internal(utf16.length(), !highByteZero);
-    for (uint32_t i=0; i<utf16.length(); i++) {
-      __jsstr_set_char(result, i, utf16[i]);
-    }
-
+    result = __jsstr_builder_finish(&strb);
     return true ;
 
   report_bad_uri:
@@ -354,7 +332,7 @@ Decode(__jsstring *src_js_str, __jsstring *&result, const bool *reservedSet, con
 
 __jsstring *__jsop_encode_item(__jsstring *value, bool component) {
   uint32_t value_sz = __jsstr_get_length(value), result_sz;
-  char char_result[value_sz * 3 + 1]; // Use the *3 since most encoding is
+  __jsstr_builder char_result;
   int ret = 0;
 
 #ifdef DEBUG_E
@@ -363,8 +341,8 @@ __jsstring *__jsop_encode_item(__jsstring *value, bool component) {
   printf("](%d)\n", value_sz);
 #endif
 
-  ret = Encode(value, char_result, js_uriUnescapeSet, js_uriReserveSet, component);
-  __jsstring *result = __jsstr_new_from_char(char_result);
+  ret = Encode(value, &char_result, js_uriUnescapeSet, js_uriReserveSet, component);
+  __jsstring *result = __jsstr_builder_finish(&char_result);
   result_sz = __jsstr_get_length(result);
 
   if (value_sz == 0 || result_sz == 0|| ret > 0) {
@@ -378,7 +356,9 @@ __jsstring *__jsop_encode_item(__jsstring *value, bool component) {
   }
 
 #ifdef DEBUG_E
-  printf("Info: encoding data result - [%s](%zu)\n", char_result, strlen(char_result));
+  printf("Info: encoding data result - [");
+  __jsstr_print(result);
+  printf("](%u)\n", result_sz);
 #endif
 
   return result;
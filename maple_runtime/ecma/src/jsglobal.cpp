@@ -35,6 +35,7 @@ __jsobject *__js_new_obj_obj_0() {
   obj->object_class = JSOBJECT;
   obj->extensible = (uint8_t) true;
   obj->object_type = (uint8_t)JSREGULAR_OBJECT;
+  obj->shape = __jsshape_get_root();
   return obj;
 }
 
@@ -336,20 +336,20 @@ __jsvalue CompareStrings(__jsvalue *collator, __jsvalue *x, __jsvalue *y) {
   y_uchar[y_len] = '\0';
   if (__jsstr_is_ascii(x_str)) {
     for (int i = 0; i < x_len; i++) {
-      x_uchar[i] = x_str->x.ascii[i];
+      x_uchar[i] = __jsstr_get_ascii(x_str)[i];
     }
   } else {
     for (int i = 0; i < x_len; i++) {
-      x_uchar[i] = x_str->x.utf16[i];
+      x_uchar[i] = __jsstr_get_utf16(x_str)[i];
     }
   }
   if (__jsstr_is_ascii(y_str)) {
     for (int i = 0; i < y_len; i++) {
-      y_uchar[i] = y_str->x.ascii[i];
+      y_uchar[i] = __jsstr_get_ascii(y_str)[i];
     }
   } else {
     for (int i = 0; i < y_len; i++) {
-      y_uchar[i] = y_str->x.utf16[i];
+      y_uchar[i] = __jsstr_get_utf16(y_str)[i];
     }
   }
   UCollationResult col_res = ucol_strcoll(col, x_uchar, x_len, y_uchar, y_len);
@@ -379,7 +379,7 @@ std::string ValToStr(__jsvalue *value) {
   }
   __jsstring *jsstr = __jsval_to_string(value);
   int len = __jsstr_get_length(jsstr);
-  std::string res(jsstr->x.ascii, len);
+  std::string res(__jsstr_get_ascii(jsstr), len);
   return res;
 }
 
@@ -411,7 +411,7 @@ __jsvalue __js_IntlConstructor(__jsvalue *this_arg, __jsvalue *arg_list,
 __jsvalue CanonicalizeLanguageTag(__jsstring *locale) {
   std::string loc;
   if (__jsstr_is_ascii(locale)) {
-    loc = std::string(locale->x.ascii, __jsstr_get_length(locale));
+    loc = std::string(__jsstr_get_ascii(locale), __jsstr_get_length(locale));
   }
   // Start with lower case for easier processing.
   std::transform(loc.begin(), loc.end(), loc.begin(), ::tolower);
@@ -541,7 +541,7 @@ bool IsStructurallyValidLanguageTag(__jsstring *tag) {
                                   + alpha_num + "{2,8}-)*\\3(?!" + alpha_num + ")";
   std::string tag_str;
   int len = __jsstr_get_length(tag);
-  tag_str.assign(tag->x.ascii, len);
+  tag_str.assign(__jsstr_get_ascii(tag), len);
 
   std::smatch sm;
   std::regex re(language_tag);
@@ -721,7 +721,7 @@ __jsvalue RemoveUnicodeExtensions(__jsvalue *locale) {
   std::string loc;
   __jsstring *loc_str = __jsval_to_string(locale);
   int len = __jsstr_get_length(loc_str);
-  loc.assign(loc_str->x.ascii, len);
+  loc.assign(__jsstr_get_ascii(loc_str), len);
   loc += '\0';
 
   // "Unicode locale extension sequence" defined as:
@@ -788,7 +788,7 @@ __jsvalue LookupMatcher(__jsvalue *available_locales, __jsvalue *requested_local
       // Step 6b i.
       std::string loc;
       int len = __jsstr_get_length(locale_str);
-      loc.assign(locale_str->x.ascii, len);
+      loc.assign(__jsstr_get_ascii(locale_str), len);
       loc += '\0';
 
       // Step 6b ii.
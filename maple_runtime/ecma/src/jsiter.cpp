@@ -35,6 +35,10 @@ __jsiterator *__jsop_valueto_iterator(__jsvalue *value, uint32_t flags) {
   itr->isNew = true;
 
   __create_builtin_property(itr->obj, NULL);
+  if (itr->obj->shape) {
+    // The iterator walks prop_list.
+    __jsobj_helper_shape_to_props(itr->obj);
+  }
   if (itr->obj->object_class == JSARRAY) {
     __jsobj_helper_convert_to_generic(itr->obj);
     uint32_t len = __jsobj_helper_get_length(itr->obj);
@@ -31,10 +31,18 @@
 #include "jsregexp.h"
 #include "jsglobal.h"
 #include "jsintl.h"
+#include "jspropcache.h"
 
 #if __clang_major__ >= 4
 #pragma clang diagnostic ignored "-Waddress-of-packed-member"
 #endif
+static __jsprop_ic *__jsprop_ic_no_sites[1] = { NULL };
+__jsprop_ic **__jsprop_ic_sites = __jsprop_ic_no_sites;
+uint32_t __jsprop_ic_sites_mask = 0;
+static uint32_t __jsprop_ic_num_sites = 0;
+// Last ic_key given to an object.
+static uint32_t __jsprop_ic_last_key = 0;
+
 // Helper function for object constructors.
 void __jsobj_set_prototype(__jsobject *obj, __jsobject *proto_obj) {
   obj->proto_is_builtin = false;
@@ -42,32 +50,29 @@ void __jsobj_set_prototype(__jsobject *obj, __jsobject *proto_obj) {
   GCIncRf((void *)proto_obj);
 }
 
+#ifdef USE_PROP_MAP
+// Find name in the prop_string_map of obj. The keys are atoms, so a
+// name with another address can only match through its atom.
+static __jsprop *__jsobj_helper_find_name(__jsobject *obj, __jsstring *name) {
+  __jsprop *p = __jsprop_dict_get(obj->prop_string_map, name);
+  if (!p) {
+    __jsstring *atom = __jsstr_lookup_atom(name);
+    if (atom && atom != name) {
+      p = __jsprop_dict_get(obj->prop_string_map, atom);
+    }
+  }
+  return p;
+}
+#endif
+
 static __jsprop *__jsobj_helper_get_property(__jsobject *obj, __jsstring *name, bool createBuiltin = true) {
+  if (obj->shape) {
+    // The caller wants a __jsprop, which objects in shape mode don't have.
+    __jsobj_helper_shape_to_props(obj);
+  }
 #ifdef USE_PROP_MAP
   if (obj->prop_string_map != NULL) {
-    std::map<__jsstring *, __jsprop *>::iterator it;
-      it = obj->prop_string_map->find(name);
-    __jsprop *p = NULL;
-    if (it != obj->prop_string_map->end()) {
-      p = it->second;
-    } else { // name could be copied to a new string, find by name
-      if (__jsstr_is_ascii(name)) {
-        for (it = obj->prop_string_map->begin(); it != obj->prop_string_map->end(); ++it) {
-          if (__jsstr_equal(it->first, name)) {
-            p = it->second; // found by name
-            break;
-          }
-        }
-      } else {
-        std::wstring w_name = __jsstr_to_wstring(name);
-        for (it = obj->prop_string_map->begin(); it != obj->prop_string_map->end(); ++it) {
-          if (__jsstr_to_wstring(it->first) == w_name) {
-            p = it->second; // found by name
-            break;
-          }
-        }
-      }
-    }
+    __jsprop *p = __jsobj_helper_find_name(obj, name);
     if (p) {
         if (__is_undefined_desc(p->desc)) {
           return NULL;
@@ -160,11 +165,11 @@ static void InsertIndexProp(__jsprop *prop, __jsprop **propList, __jsobject *obj
         (*(obj->prop_index_map))[prop->n.index] = prop;
       } else {
         if (obj->prop_string_map == NULL) {
-          obj->prop_string_map = new std::map<__jsstring *, __jsprop *>();
+          obj->prop_string_map = __jsprop_dict_new();
         }
         else
-          assert(obj->prop_string_map->empty() && "prop_string_map should be empty at this time");
-        (*(obj->prop_string_map))[prop->n.name] = prop;
+          assert(__jsprop_dict_empty(obj->prop_string_map) && "prop_string_map should be empty at this time");
+        __jsprop_dict_put(obj->prop_string_map, prop->n.name, prop);
       }
       // The first entry's prev points to the list entry. The last entry's next is NULL
       prop->prev = prop;
@@ -208,21 +213,19 @@ static void InsertIndexProp(__jsprop *prop, __jsprop **propList, __jsobject *obj
       }
       (*(obj->prop_index_map))[prop->n.index] = prop;
     } else { // !isIndex
-      if (obj->prop_string_map == NULL || (*obj->prop_string_map).empty()) {
+      if (obj->prop_string_map == NULL || __jsprop_dict_empty(obj->prop_string_map)) {
         if (obj->prop_string_map == NULL) {
-          obj->prop_string_map = new std::map<__jsstring *, __jsprop *>();
+          obj->prop_string_map = __jsprop_dict_new();
         }
-        (*(obj->prop_string_map))[prop->n.name] = prop;
+        __jsprop_dict_put(obj->prop_string_map, prop->n.name, prop);
         prop->prev = (*propList)->prev;
         (*propList)->prev->next = prop;
         (*propList)->prev = prop;
         return;
       }
 
-      std::map<__jsstring *, __jsprop *>::iterator it;
-      it = obj->prop_string_map->find(prop->n.name);
-      if (it != obj->prop_string_map->end()) {
-        __jsprop *old_prop = it->second;
+      __jsprop *old_prop = __jsprop_dict_get(obj->prop_string_map, prop->n.name);
+      if (old_prop) {
         prop->next = old_prop->next;
         prop->prev = old_prop->prev;
         if (old_prop->next) // old_prop is not the last one
@@ -233,8 +236,9 @@ static void InsertIndexProp(__jsprop *prop, __jsprop **propList, __jsobject *obj
           assert(old_prop->prev->next != nullptr && "prev should not be the last one");
           old_prop->prev->next = prop;
         }
+        __jsobj_invalidate_layout(obj);
         memory_manager->ManageProp(old_prop, RECALL);
-        it->second = prop;
+        __jsprop_dict_put(obj->prop_string_map, prop->n.name, prop);
         return;
       }
 
@@ -245,7 +249,7 @@ static void InsertIndexProp(__jsprop *prop, __jsprop **propList, __jsobject *obj
       (*propList)->prev = prop;
       prop->next = nullptr;
 
-      (*(obj->prop_string_map))[prop->n.name] = prop;
+      __jsprop_dict_put(obj->prop_string_map, prop->n.name, prop);
     }
   }
   return;
@@ -313,6 +317,9 @@ static void InsertIndexProp(__jsprop *prop, __jsprop **propList, __jsobject *obj
 }
 
 static __jsprop *__jsobj_helper_create_propertyByValue(__jsobject *obj, uint32_t index) {
+  if (obj->shape) {
+    __jsobj_helper_shape_to_props(obj);
+  }
   __jsprop *prop = (__jsprop *)VMMallocGC(sizeof(__jsprop), MemHeadJSProp, false);
   InitProp(prop, __new_empty_desc(), index);
   // assert(obj->object_class != JSARRAY && "shouldn't be a regular jsarray");
@@ -321,13 +328,82 @@ static __jsprop *__jsobj_helper_create_propertyByValue(__jsobject *obj, uint32_t
 }
 
 static __jsprop *__jsobj_helper_create_property(__jsobject *obj, __jsstring *name) {
+  if (obj->shape) {
+    __jsobj_helper_shape_to_props(obj);
+  }
   __jsprop *prop = (__jsprop *)VMMallocGC(sizeof(__jsprop), MemHeadJSProp, false);
-  InitProp(prop, __new_empty_desc(), name);
+  // prop_string_map is keyed by atoms only, see __jsobj_helper_find_name.
+  InitProp(prop, __new_empty_desc(), __jsstr_intern(name));
   GCIncRf(prop->n.name);
   InsertIndexProp(prop, &obj->prop_list, obj);
   return prop;
 }
 
+// Leave shape mode: give each slot of obj a __jsprop in prop_list, in slot order.
+void __jsobj_helper_shape_to_props(__jsobject *obj) {
+  __jsshape *shape = obj->shape;
+  __jsvalue *slots = obj->slots;
+  obj->shape = NULL;
+  obj->slots = NULL;
+  for (uint32_t i = 0; i < shape->slot_count; i++) {
+    __jsprop *prop = __jsobj_helper_create_property(obj, shape->names[i]);
+    // The reference held by the slot moves to the property.
+    prop->desc = __new_value_desc(&slots[i], JSPROP_DESC_HAS_VWEC);
+  }
+  if (slots) {
+    memory_manager->RecallMem((void *)slots, __jsshape_slot_capacity(shape->slot_count) * sizeof(__jsvalue));
+  }
+}
+
+static inline void __jsobj_helper_shape_set_slot(__jsobject *obj, uint32_t slot, __jsvalue *v) {
+  __jsvalue *to = &obj->slots[slot];
+  GCCheckAndUpdateRf(to->x.asbits, IsNeedRc(to->ptyp), v->x.asbits, IsNeedRc(v->ptyp));
+  *to = *v;
+}
+
+// Add a new data property with default attributes to an object in shape mode.
+// Return false if the shape can't grow, the caller falls back to prop_list.
+static bool __jsobj_helper_shape_add(__jsobject *obj, __jsstring *name, __jsvalue *v) {
+  __jsshape *shape = obj->shape;
+  if (!obj->extensible) {
+    return false;
+  }
+  __jsshape *next = __jsshape_add_transition(shape, name);
+  if (!next) {
+    return false;
+  }
+  uint32_t count = shape->slot_count;
+  if (!obj->slots) {
+    obj->slots = (__jsvalue *)VMMallocGC(__jsshape_slot_capacity(1) * sizeof(__jsvalue), MemHeadAny, false);
+  } else {
+    uint32_t cap = __jsshape_slot_capacity(count);
+    if (count == cap) {
+      obj->slots = (__jsvalue *)VMReallocGC(obj->slots, cap * sizeof(__jsvalue), 2 * cap * sizeof(__jsvalue), false);
+    }
+  }
+  obj->slots[count] = *v;
+  GCCheckAndIncRf(v->x.asbits, IsNeedRc(v->ptyp));
+  obj->shape = next;
+  return true;
+}
+
+// Define or overwrite the data property name of an object in shape mode, with
+// default attributes. Return false if obj had to leave shape mode instead.
+static bool __jsobj_helper_shape_put(__jsobject *obj, __jsstring *name, __jsvalue *v) {
+  int32_t slot = __jsshape_lookup(obj->shape, name);
+  if (slot >= 0) {
+    __jsobj_helper_shape_set_slot(obj, (uint32_t)slot, v);
+    return true;
+  }
+  bool isNum;
+  __jsstr_is_numidx(name, isNum);
+  if (!isNum && __jsobj_helper_shape_add(obj, name, v)) {
+    return true;
+  }
+  __jsobj_helper_shape_to_props(obj);
+  return false;
+}
+
 
 typedef bool (*callback_fp)(__jsprop *, uint32_t, void *);
 typedef bool (*condtion_fp)(__jsprop *);
@@ -335,8 +411,22 @@ typedef bool (*condtion_fp)(__jsprop *);
 // Return the number of properties iterated.
 uint32_t __jsobj_helper_for_each_property(__jsobject *obj, callback_fp callback, void *result,
                                           condtion_fp condition = NULL) {
-  __jsprop *p = obj->prop_list;
   uint32_t n = 0;
+  if (obj->shape) {
+    // Walk the slots through a temporary property, callbacks only read it.
+    __jsprop slot_prop;
+    for (uint32_t i = 0; i < obj->shape->slot_count; i++) {
+      InitProp(&slot_prop, __new_value_desc(&obj->slots[i], JSPROP_DESC_HAS_VWEC), obj->shape->names[i]);
+      if (!condition || condition(&slot_prop)) {
+        if (callback && !callback(&slot_prop, n, result)) {
+          return n++;
+        }
+        n++;
+      }
+    }
+    return n;
+  }
+  __jsprop *p = obj->prop_list;
   while (p) {
     if (!condition || condition(p)) {
       if (callback && !callback(p, n, result)) {
@@ -401,7 +491,11 @@ __jsprop *__jsobj_helper_init_value_propertyByValue(__jsobject *obj, uint32_t in
   return prop;
 }
 
+// Return NULL if the property went to a slot of obj.
 __jsprop *__jsobj_helper_init_value_property(__jsobject *obj, __jsstring *p, __jsvalue *v, uint32_t attrs) {
+  if (obj->shape && attrs == JSPROP_DESC_HAS_VWEC && __jsobj_helper_shape_put(obj, p, v)) {
+    return NULL;
+  }
   __jsprop *prop = __jsobj_helper_create_property(obj, p);
   prop->desc = __new_value_desc(v, attrs);
   GCCheckAndIncRf(v->x.asbits, IsNeedRc(v->ptyp));
@@ -1170,6 +1264,13 @@ __jsprop_desc __jsobj_internal_GetOwnProperty(__jsobject *o, __jsstring *p, __js
   if (isNum) {
     return __jsobj_internal_GetOwnPropertyByValue(o, idxNum);
   }
+  if (o->shape) {
+    int32_t slot = __jsshape_lookup(o->shape, p);
+    if (slot < 0) {
+      return __undefined_desc();
+    }
+    return __new_value_desc(&o->slots[slot], JSPROP_DESC_HAS_VWEC);
+  }
   __jsobj_helper_convert_to_generic(o);
   __jsprop *prop = __jsobj_helper_get_property(o, p);
   // ecma 8.12.1 step 1: if o doesn't have an own property with name p, return
@@ -1289,6 +1390,17 @@ __jsvalue __jsobj_internal_GetByValue(__jsobject *obj, uint32_t index) {
 __jsvalue __jsobj_internal_Get(__jsobject *obj, __jsstring *p) {
   // Fast path.
   if (obj->object_type == JSREGULAR_OBJECT) {
+    if (obj->shape) {
+      int32_t slot = __jsshape_lookup(obj->shape, p);
+      if (slot >= 0) {
+        return obj->slots[slot];
+      }
+      __jsobject *proto = __jsobj_get_prototype(obj);
+      if (proto) {
+        return __jsobj_internal_Get(proto, p);
+      }
+      return __undefined_value();
+    }
     __jsprop *prop = __jsobj_helper_get_property(obj, p);
     if (prop) {
       return __get_value(prop->desc);
@@ -1564,6 +1676,9 @@ void __jsobj_internal_Put(__jsobject *o, __jsstring *p, __jsvalue *v, bool throw
   }
   //  Fast path.
   if (__jsobj_helper_is_all_regular(o)) {
+    if (o->shape && __jsobj_helper_shape_put(o, p, v)) {
+      return;
+    }
     __jsprop *prop = __jsobj_helper_get_property(o, p);
     if (prop) {
       __jsprop_desc desc = prop->desc;
@@ -1723,29 +1838,7 @@ bool __jsobj_internal_Delete(__jsobject *o, __jsstring *p, bool mark_as_deleted,
   bool property_created = false;
   for (;;) {
     if (o->prop_string_map) {
-      std::map<__jsstring *, __jsprop *>::iterator it, prev;
-      it = o->prop_string_map->find(p);
-      __jsprop *prop = NULL;
-      if (it != o->prop_string_map->end()) {
-        prop = it->second;
-      } else {
-        if (__jsstr_is_ascii(p)) {
-          for (it = o->prop_string_map->begin(); it != o->prop_string_map->end(); ++it) {
-            if (__jsstr_equal(it->first, p)) {
-              prop = it->second; // found by name
-              break;
-            }
-          }
-        } else {
-          std::wstring w_name = __jsstr_to_wstring(p);
-          for (it = o->prop_string_map->begin(); it != o->prop_string_map->end(); ++it) {
-            if (__jsstr_to_wstring(it->first) == w_name) {
-              prop = it->second; // found by name
-              break;
-            }
-          }
-        }
-      }
+      __jsprop *prop = __jsobj_helper_find_name(o, p);
       if (prop) {
         __jsprop_desc desc = prop->desc;
         if (__has_and_configurable(desc)) {
@@ -1766,7 +1859,8 @@ bool __jsobj_internal_Delete(__jsobject *o, __jsstring *p, bool mark_as_deleted,
                 o->prop_list->prev = prop->prev; // the last one
               }
             }
-            o->prop_string_map->erase(it);
+            __jsprop_dict_remove(o->prop_string_map, prop->n.name);
+            __jsobj_invalidate_layout(o);
             memory_manager->ManageProp(prop, RECALL);
           }
           return true;
@@ -1802,6 +1896,7 @@ bool __jsobj_internal_Delete(__jsobject *o, __jsstring *p, bool mark_as_deleted,
             prop->desc = __undefined_desc();
           } else {
             *prop_p = prop->next;
+            __jsobj_invalidate_layout(o);
             memory_manager->ManageProp(prop, RECALL);
           }
           return true;
@@ -1877,6 +1972,9 @@ void __jsobj_helper_convert_to_generic(__jsobject *obj) {
     case JSGENERIC:
       return;
     case JSREGULAR_OBJECT:
+      if (obj->shape) {
+        __jsobj_helper_shape_to_props(obj);
+      }
       obj->object_type = JSGENERIC;
       return;
     case JSREGULAR_ARRAY: {
@@ -2125,6 +2223,16 @@ void __jsobj_internal_DefineOwnPropertyByValue(__jsobject *o, uint32_t index, __
 }
 // ecma 8.12.9
 void __jsobj_internal_DefineOwnProperty(__jsobject *o, __jsstring *p, __jsprop_desc desc, bool throw_p, __jsprop *prop_cache) {
+  // A data property keeping the default attributes stays in shape mode.
+  if (o->shape && !prop_cache && __has_value(desc) && !__has_get_or_set(desc) &&
+      (desc.attrs == JSPROP_DESC_HAS_VWEC ||
+       (__jsshape_lookup(o->shape, p) >= 0 && !__has_and_unwritable(desc) &&
+        !__has_and_unenumerable(desc) && !__has_and_unconfigurable(desc)))) {
+    __jsvalue v = __get_value(desc);
+    if (__jsobj_helper_shape_put(o, p, &v)) {
+      return;
+    }
+  }
   __jsobj_helper_convert_to_generic(o);
   // ecma 8.12.9 step 1
   __jsprop_desc current;
@@ -2323,7 +2431,10 @@ __jsvalue __jsobj_getOwnPropertyNames(__jsvalue *this_object, __jsvalue *o) {
   // ecma 20.1.2.11.1 step 1
   __jsobject *obj = __js_ToObject(o);
   __create_builtin_property(obj, NULL);
-  __jsobj_helper_convert_to_generic(obj);
+  // Only regular arrays keep properties outside of prop_list and slots.
+  if (obj->object_type == JSREGULAR_ARRAY) {
+    __jsobj_helper_convert_to_generic(obj);
+  }
   uint32_t n = __jsobj_helper_for_each_property(obj, NULL, NULL);
   __jsobject *arr = __js_new_arr_internal(n);
   __jsobj_helper_for_each_property(obj, __jsobj_walk_getOwnPropertyNames, (void *)arr);
@@ -2601,7 +2712,10 @@ bool __jsobj_walk_keys(__jsprop *prop, uint32_t n, void *result) {
 __jsvalue __jsobj_keys(__jsvalue *this_object, __jsvalue *o) {
   // ecma 20.1.2.17 step 1.
   __jsobject *obj = __js_ToObject(o);
-  __jsobj_helper_convert_to_generic(obj);
+  // Only regular arrays keep properties outside of prop_list and slots.
+  if (obj->object_type == JSREGULAR_ARRAY) {
+    __jsobj_helper_convert_to_generic(obj);
+  }
   uint32_t n = __jsobj_helper_for_each_property(obj, NULL, NULL, __jsobj_walk_keys_condition);
   // ecma 15.2.3.14 step 3.
   __jsobject *arr = __js_new_arr_internal(n);
@@ -2768,7 +2882,7 @@ void __jsop_setprop(__jsvalue *o, __jsvalue *p, __jsvalue *v) {
     if (index != MAX_ARRAY_INDEX) {
       if (index <= ARRAY_MAXINDEXNUM_INTERNAL) {
         if (index >= length) {
-          obj->shared.array_props = __jsarr_RegularRealloc(array, length, index + 1);
+          obj->shared.array_props = __jsarr_RegularRealloc(array, length, index + 1, index == length);
           array = obj->shared.array_props;
         }
         __set_regular_elem(array, index, v);
@@ -2777,9 +2891,8 @@ void __jsop_setprop(__jsvalue *o, __jsvalue *p, __jsvalue *v) {
         MAPLE_JS_ASSERT(index > ARRAY_MAXINDEXNUM_INTERNAL && index < MAX_ARRAY_INDEX);
         // update array length
         if (index >= length) {
-          obj->shared.array_props = __jsarr_RegularRealloc(array, length, ARRAY_MAXINDEXNUM_INTERNAL);
-          obj->shared.array_props[0] = (index+1 < INT32_MAX) ? __number_value(index+1) :
-                                                               __double_value(index+1);
+          // The elements past ARRAY_MAXINDEXNUM_INTERNAL are not stored.
+          obj->shared.array_props = __jsarr_RegularRealloc(array, length, index + 1);
         }
       }
     } else {
@@ -2934,6 +3047,136 @@ static __jsprop * __jsop_get_prop_jsobject(__jsobject *obj, __jsstring *name) {
   return p;
 }
 
+// Insert the inline cache of SITE in the table, growing it to stay at most
+// half full.
+__jsprop_ic *__jsprop_ic_add_site(const void *site) {
+  uint32_t mask = __jsprop_ic_sites_mask;
+  uint32_t i = __jsprop_ic_hash(site) & mask;
+  for (; __jsprop_ic_sites[i]; i = (i + 1) & mask) {
+    if (__jsprop_ic_sites[i]->site == site) {
+      return __jsprop_ic_sites[i];
+    }
+  }
+  if (2 * (__jsprop_ic_num_sites + 1) > mask + 1) {
+    uint32_t size = mask + 1 < JSPROP_IC_MIN_SITES ? JSPROP_IC_MIN_SITES : 2 * (mask + 1);
+    __jsprop_ic **sites = new __jsprop_ic *[size]();
+    for (uint32_t j = 0; j <= mask; j++) {
+      __jsprop_ic *old = __jsprop_ic_sites[j];
+      if (old) {
+        uint32_t k = __jsprop_ic_hash(old->site) & (size - 1);
+        while (sites[k]) {
+          k = (k + 1) & (size - 1);
+        }
+        sites[k] = old;
+      }
+    }
+    if (__jsprop_ic_sites != __jsprop_ic_no_sites) {
+      delete[] __jsprop_ic_sites;
+    }
+    __jsprop_ic_sites = sites;
+    __jsprop_ic_sites_mask = mask = size - 1;
+    i = __jsprop_ic_hash(site) & mask;
+    while (sites[i]) {
+      i = (i + 1) & mask;
+    }
+  }
+  __jsprop_ic *ic = new __jsprop_ic();
+  ic->site = site;
+  __jsprop_ic_sites[i] = ic;
+  __jsprop_ic_num_sites++;
+  return ic;
+}
+
+// Keys are about to be given again, forget all the entries of receivers.
+static void __jsprop_ic_drop_object_entries() {
+  for (uint32_t i = 0; i <= __jsprop_ic_sites_mask; i++) {
+    __jsprop_ic *ic = __jsprop_ic_sites[i];
+    if (!ic) {
+      continue;
+    }
+    uint32_t n = 0;
+    for (uint32_t j = 0; j < ic->num_entries; j++) {
+      if (ic->entries[j].shape) {
+        ic->entries[n++] = ic->entries[j];
+      }
+    }
+    ic->num_entries = n;
+    ic->victim = 0;
+  }
+}
+
+void __jsprop_ic_fill(__jsprop_ic *ic, __jsobject *obj, __jsstring *name, bool for_set) {
+  if (ic->state == JSPROP_IC_MEGA) {
+    return;
+  }
+  // Only ordinary objects. Arrays, string and arguments objects have their own
+  // [[DefineOwnProperty]] or index handling, and plug-in objects are opaque.
+  if (obj->object_type == JSREGULAR_ARRAY || obj->object_type == JSEXTERN) {
+    return;
+  }
+  if (obj->object_class != JSOBJECT && obj->object_class != JSGLOBAL &&
+      (for_set || obj->object_class != JSFUNCTION)) {
+    return;
+  }
+  bool isNum;
+  __jsstr_is_numidx(name, isNum);
+  if (isNum) {
+    return;
+  }
+  __jsshape *shape = obj->shape;
+  __jsprop *prop = NULL;
+  int32_t slot = -1;
+  if (shape) {
+    slot = __jsshape_lookup(shape, name);
+    if (slot < 0) {
+      return;
+    }
+  } else {
+    prop = __jsobj_helper_get_property(obj, name, false);
+    if (!prop || !__jsprop_ic_is_plain_data(prop->desc)) {
+      return;
+    }
+    if (!obj->ic_key) {
+      if (++__jsprop_ic_last_key == 0) {
+        __jsprop_ic_drop_object_entries();
+        __jsprop_ic_last_key = 1;
+      }
+      obj->ic_key = __jsprop_ic_last_key;
+    }
+  }
+  __jsprop_ic_entry *e = NULL;
+  for (uint32_t i = 0; i < ic->num_entries; i++) {
+    __jsprop_ic_entry *entry = &ic->entries[i];
+    if (entry->name == name && (shape ? entry->shape == shape : (!entry->shape && entry->obj == obj))) {
+      e = entry;
+      break;
+    }
+  }
+  if (!e) {
+    if (ic->num_entries < JSPROP_IC_WAYS) {
+      e = &ic->entries[ic->num_entries++];
+      ic->state = ic->num_entries == 1 ? JSPROP_IC_MONO : JSPROP_IC_POLY;
+    } else if (++ic->misses >= JSPROP_IC_MEGA_MISSES) {
+      ic->state = JSPROP_IC_MEGA;
+      ic->num_entries = 0;
+      return;
+    } else {
+      e = &ic->entries[ic->victim];
+      ic->victim = (ic->victim + 1) % JSPROP_IC_WAYS;
+    }
+  }
+  e->name = name;
+  e->shape = shape;
+  if (shape) {
+    e->obj = NULL;
+    e->u.slot = (uint32_t)slot;
+  } else {
+    e->obj = obj;
+    e->key = obj->ic_key;
+    e->u.prop = prop;
+  }
+}
+
 // make things faster
 __jsvalue __jsop_get_this_prop_by_name(__jsvalue *o,  __jsstring *name) {
   __jsobject *obj = __is_js_object(o) ? __jsval_to_object(o) : __js_ToObject(o);
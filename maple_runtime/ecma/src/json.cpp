@@ -442,11 +442,8 @@ __jsvalue __json_parse_value(__json_token *token) {
           break;
         }
 
-        __jsstring *name = __js_new_string_internal(string_size, false);
+        __jsstring *name = __jsstr_intern_ascii((const char *)string_start, string_size);
         GCIncRf(name);
-        for (uint32_t i = 0; i < string_size; i++) {
-          __jsstr_set_char(name, i, (uint16_t)(*(string_start + i)));
-        }
         __jsobj_helper_add_value_property(obj, name, &value, JSPROP_DESC_HAS_VWEC);
         GCDecRf(name);
         parse_comma = true;
@@ -476,7 +473,13 @@ __jsvalue __json_parse_value(__json_token *token) {
           break;
         }
 
-        __set_generic_elem(arr, length, &value);
+        if (arr->object_type == JSREGULAR_ARRAY && length < ARRAY_MAXINDEXNUM_INTERNAL) {
+          // Append to the elements, their kind follows the values.
+          arr->shared.array_props = __jsarr_RegularRealloc(arr->shared.array_props, length, length + 1, true);
+          __set_regular_elem(arr->shared.array_props, length, &value);
+        } else {
+          __set_generic_elem(arr, length, &value);
+        }
         length++;
         parse_comma = true;
       }
@@ -497,7 +500,7 @@ __jsvalue __json_parse(__jsvalue *this_json, __jsvalue *text, __jsvalue *reviver
   __jsstring *jtext = __js_ToString(text);
   //  MAPLE_JS_ASSERT(__jsstr_is_ascii(jtext));
   __json_token token;
-  uint8_t *start = (uint8_t *)jtext + 4;
+  uint8_t *start = (uint8_t *)__jsstr_get_ascii(jtext);
   token.current = start;
   token.end = start + __jsstr_get_length(jtext);
   __jsvalue res = __json_parse_value(&token);
@@ -518,7 +521,7 @@ __jsvalue __json_parse(__jsvalue *this_json, __jsvalue *text, __jsvalue *reviver
 __jsvalue __json_stringify(__jsvalue *this_json, __jsvalue *value, __jsvalue *replacer, __jsvalue *space) {
   __json_stringify_context context;
   // 1. Let stack be an empty List
-  context.stack = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList);
+  context.stack = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList, false);
   errno_t set_ret = memset_s(context.stack, sizeof(__json_list), 0, sizeof(__json_list));
   if (set_ret != EOK) {
     MIR_FATAL("call memset_s failed in __json_stringify");
@@ -527,7 +530,7 @@ __jsvalue __json_stringify(__jsvalue *this_json, __jsvalue *value, __jsvalue *re
   // 2
   context.indent_str = __jsstr_get_builtin(JSBUILTIN_STRING_EMPTY);
   // 3.
-  context.property_list = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList);
+  context.property_list = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList, false);
   errno_t set_ret1 = memset_s(context.property_list, sizeof(__json_list), 0, sizeof(__json_list));
   if (set_ret1 != EOK) {
     MIR_FATAL("call memset_s failed in __json_stringify");
@@ -710,31 +713,31 @@ __jsvalue __json_str(__jsvalue *key, __jsobject *holder, __json_stringify_contex
 }
 
 __jsstring *__json_quote(uint32_t index) {
-  __jsstring *product = __js_new_string_internal(1, false);
-  __jsstr_set_char(product, 0, JS_CHAR_DOUBLE_QUOTE);
+  __jsstr_builder product;
+  __jsstr_builder_append_char(&product, JS_CHAR_DOUBLE_QUOTE);
   __jsstring *str = __js_NumberToString(index);
-  product = __jsstr_concat_2(product, str);
-  return __jsstr_append_char(product, JS_CHAR_DOUBLE_QUOTE);
+  __jsstr_builder_append(&product, str);
+  memory_manager->RecallString(str);
+  __jsstr_builder_append_char(&product, JS_CHAR_DOUBLE_QUOTE);
+  return __jsstr_builder_finish(&product);
 }
 
-// The abstract operation Quote(value)
-__jsstring *__json_quote(__jsstring *value) {
-  __jsstring *product = __js_new_string_internal(1, false);
-  __jsstr_set_char(product, 0, JS_CHAR_DOUBLE_QUOTE);
-  // MAPLE_JS_ASSERT(__jsstr_is_ascii(value));
+// Append Quote(value) to product.
+static void __json_quote_to(__jsstr_builder *product, __jsstring *value) {
+  __jsstr_builder_append_char(product, JS_CHAR_DOUBLE_QUOTE);
   uint32_t len = __jsstr_get_length(value);
   for (uint32_t i = 0; i < len; i++) {
     uint16_t c;
     if (__jsstr_is_ascii(value)) {
-      c = ((uint8_t *)value)[4 + i];
+      c = ((uint8_t *)__jsstr_get_ascii(value))[i];
     } else {
-      c = ((uint16_t *)value)[2 + i];
+      c = __jsstr_get_utf16(value)[i];
     }
     if (c == JS_CHAR_DOUBLE_QUOTE || c == JS_CHAR_BACKSLASH) {
-      product = __jsstr_append_char(product, JS_CHAR_BACKSLASH);
-      product = __jsstr_append_char(product, c);
+      __jsstr_builder_append_char(product, JS_CHAR_BACKSLASH);
+      __jsstr_builder_append_char(product, c);
     } else if (c == JS_CHAR_BS || c == JS_CHAR_FF || c == JS_CHAR_LF || c == JS_CHAR_CR || c == JS_CHAR_TAB) {
-      product = __jsstr_append_char(product, JS_CHAR_BACKSLASH);
+      __jsstr_builder_append_char(product, JS_CHAR_BACKSLASH);
       char abbrev = '\0';
       switch (c) {
         case JS_CHAR_BS:
@@ -756,21 +759,57 @@ __jsstring *__json_quote(__jsstring *value) {
           MAPLE_JS_ASSERT(false);
           break;
       }
-      product = __jsstr_append_char(product, (uint16_t)abbrev);
+      __jsstr_builder_append_char(product, (uint16_t)abbrev);
     } else if (c <= 0x1f || c >= 0x80) {
-      product = __jsstr_append_char(product, JS_CHAR_BACKSLASH);
-      product = __jsstr_append_char(product, JS_CHAR_LOWERCASE_U);
       char h[8];
-      sprintf(h, "%04x", c);
-      for (int i = 0; i < 4; i++) {
-        product = __jsstr_append_char(product, h[i]);
-      }
+      sprintf(h, "\\u%04x", c);
+      __jsstr_builder_append_ascii(product, h, 6);
     } else {
-      product = __jsstr_append_char(product, c);
+      __jsstr_builder_append_char(product, c);
+    }
+  }
+  __jsstr_builder_append_char(product, JS_CHAR_DOUBLE_QUOTE);
+}
+
+// The abstract operation Quote(value)
+__jsstring *__json_quote(__jsstring *value) {
+  __jsstr_builder product;
+  __json_quote_to(&product, value);
+  return __jsstr_builder_finish(&product);
+}
+
+// Steps 9 and 10 of JO and JA: wrap the serialized members in partial between
+// left and right, separated by commas and indented if there is a gap.
+static __jsstring *__json_join_partial(__json_list *partial, __json_stringify_context *context,
+                                       __jsstring *step_back, uint16_t left, uint16_t right) {
+  __jsstr_builder product;
+  __jsstr_builder_append_char(&product, left);
+  if (partial->count != 0) {
+    bool has_gap = __jsstr_get_length(context->gap_str) != 0;
+    if (has_gap) {
+      __jsstr_builder_append_char(&product, JS_CHAR_LF);
+      __jsstr_builder_append(&product, context->indent_str);
+    }
+    __json_node *node = partial->first;
+    for (uint32_t i = 0; i < partial->count; i++) {
+      MAPLE_JS_ASSERT(__is_string(&(node->value)));
+      if (i > 0) {
+        __jsstr_builder_append_char(&product, JS_CHAR_COMMA);
+        if (has_gap) {
+          __jsstr_builder_append_char(&product, JS_CHAR_LF);
+          __jsstr_builder_append(&product, context->indent_str);
+        }
+      }
+      __jsstr_builder_append(&product, __jsval_to_string(&(node->value)));
+      node = node->next;
+    }
+    if (has_gap) {
+      __jsstr_builder_append_char(&product, JS_CHAR_LF);
+      __jsstr_builder_append(&product, step_back);
     }
   }
-  product = __jsstr_append_char(product, JS_CHAR_DOUBLE_QUOTE);
-  return product;
+  __jsstr_builder_append_char(&product, right);
+  return __jsstr_builder_finish(&product);
 }
 
 // The abstract operation JO(value) serializes an object
@@ -793,7 +832,7 @@ __jsvalue __json_object(__jsobject *val, __json_stringify_context *context) {
   } else {
     __jsvalue keys = __jsobj_keys(NULL, &value);
     __jsobject *obj = __jsval_to_object(&keys);
-    k = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList);
+    k = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList, false);
     errno_t ret1 = memset_s(k, sizeof(__json_list), 0, sizeof(__json_list));
     if (ret1 != EOK) {
       MIR_FATAL("call memset_s firstly failed in __json_object ");
@@ -804,7 +843,7 @@ __jsvalue __json_object(__jsobject *val, __json_stringify_context *context) {
     memory_manager->ManageObject(obj, RECALL);
   }
   // 7
-  __json_list *partial = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList);
+  __json_list *partial = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList, false);
   errno_t ret2 = memset_s(partial, sizeof(__json_list), 0, sizeof(__json_list));
   if (ret2 != EOK) {
     MIR_ASSERT("call memset_s secondly failed in __json_object ");
@@ -819,28 +858,30 @@ __jsvalue __json_object(__jsobject *val, __json_stringify_context *context) {
     // 8.b
     if (!__is_undefined(&str)) {
       // 8.b.i
-      __jsstring *member = NULL;
+      __jsstr_builder member;
       if (__jsval_typeof(&(node->value)) == JSTYPE_NUMBER) {
-        member = __json_quote(__jsval_to_int32(&(node->value)));
+        __jsstring *key = __json_quote(__jsval_to_int32(&(node->value)));
+        __jsstr_builder_append(&member, key);
+        memory_manager->RecallString(key);
       } else if (__jsval_typeof(&(node->value)) == JSTYPE_DOUBLE) {
-        member = __json_quote(__jsval_to_double(&(node->value)));
+        __jsstring *key = __json_quote(__jsval_to_double(&(node->value)));
+        __jsstr_builder_append(&member, key);
+        memory_manager->RecallString(key);
       } else {
-        member = __json_quote(__jsval_to_string(&(node->value)));
+        __json_quote_to(&member, __jsval_to_string(&(node->value)));
       }
       // 8.b.2
-      member = __jsstr_append_char(member, JS_CHAR_COLON);
+      __jsstr_builder_append_char(&member, JS_CHAR_COLON);
       // 8.b.3
       if (__jsstr_get_length(context->gap_str)) {
-        member = __jsstr_append_char(member, JS_CHAR_SP);
+        __jsstr_builder_append_char(&member, JS_CHAR_SP);
       }
       // 8.b.iv
       __jsstring *str_val = __jsval_to_string(&str);
-      __jsstring *tmp = __jsstr_concat_2(member, str_val);
-      memory_manager->RecallString(member);
+      __jsstr_builder_append(&member, str_val);
       memory_manager->RecallString(str_val);
-      member = tmp;
       // 8.b.v
-      __js_list_append(partial, __string_value(member));
+      __js_list_append(partial, __string_value(__jsstr_builder_finish(&member)));
     }
     i++;
     node = node->next;
@@ -848,64 +889,8 @@ __jsvalue __json_object(__jsobject *val, __json_stringify_context *context) {
   if (context->property_list->count == 0) {
     memory_manager->RecallList(k);
   }
-  __jsstring *final_str;
-  // 9.
-  if (partial->count == 0) {
-    final_str = __js_new_string_internal(2, false);
-    __jsstr_set_char(final_str, 0, JS_CHAR_LEFT_BRACE);
-    __jsstr_set_char(final_str, 1, JS_CHAR_RIGHT_BRACE);
-  } else {
-    // 10.
-    __jsstring *left_brace = __jsstr_get_builtin(JSBUILTIN_STRING_LEFT_BRACE_CHAR);
-    __jsstring *right_brace = __jsstr_get_builtin(JSBUILTIN_STRING_RIGHT_BRACE_CHAR);
-    // 10.a
-    if (__jsstr_get_length(context->gap_str) == 0) {
-      // 10.a.i
-      __json_node *node = partial->first;
-      __jsstring *property = __jsval_to_string(&(node->value));
-      __jsstring *comma = __jsstr_get_builtin(JSBUILTIN_STRING_COMMA_CHAR);
-      node = node->next;
-      while (node) {
-        __jsstring *item = __jsval_to_string(&(node->value));
-        __jsstring *tmp = __jsstr_concat_3(property, comma, item);
-        memory_manager->RecallString(property);
-        property = tmp;
-        node = node->next;
-      }
-      // 10.a.ii
-      final_str = __jsstr_concat_3(left_brace, property, right_brace);
-      memory_manager->RecallString(property);
-    } else {
-      // 10.b
-      // 10.b.i
-      uint32_t len = __jsstr_get_length(context->indent_str);
-      __jsstring *sep = __js_new_string_internal(len + 2, false);
-      __jsstr_set_char(sep, 0, JS_CHAR_COMMA);
-      __jsstr_set_char(sep, 1, JS_CHAR_LF);
-      __jsstr_copy(sep, 2, context->indent_str);
-      // 10.b.ii
-      __json_node *node = partial->first;
-      __jsstring *property = __jsval_to_string(&(node->value));
-      node = node->next;
-      __jsstring *tmp;
-      while (node) {
-        __jsstring *item = __jsval_to_string(&(node->value));
-        tmp = __jsstr_concat_3(property, sep, item);
-        memory_manager->RecallString(property);
-        property = tmp;
-        node = node->next;
-      }
-      // 10.b.iii
-      __jsstring *left = __jsstr_append_char(left_brace, JS_CHAR_LF);
-      final_str = __jsstr_concat_3(left, context->indent_str, property);
-      memory_manager->RecallString(left);
-      tmp = __jsstr_append_char(final_str, JS_CHAR_LF);
-      final_str = __jsstr_concat_3(tmp, step_back, right_brace);
-      memory_manager->RecallString(tmp);
-      memory_manager->RecallString(sep);
-      memory_manager->RecallString(property);
-    }
-  }
+  // 9. 10.
+  __jsstring *final_str = __json_join_partial(partial, context, step_back, JS_CHAR_LEFT_BRACE, JS_CHAR_RIGHT_BRACE);
   memory_manager->RecallList(partial);
   // 11.
   __js_list_pop(context->stack);
@@ -929,7 +914,7 @@ __jsvalue __json_array(__jsobject *val, __json_stringify_context *context) {
   // 4
   context->indent_str = __jsstr_concat_2(context->indent_str, context->gap_str);
   // 5
-  __json_list *partial = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList);
+  __json_list *partial = (__json_list *)VMMallocGC(sizeof(__json_list), MemHeadJSList, false);
   errno_t set_ret = memset_s(partial, sizeof(__json_list), 0, sizeof(__json_list));
   if (set_ret != EOK) {
     MIR_FATAL("call memset_s failed in __json_array");
@@ -956,73 +941,8 @@ __jsvalue __json_array(__jsobject *val, __json_stringify_context *context) {
     }
     index++;
   }
-  // 9
-  if (partial->count == 0) {
-    final_str = __js_new_string_internal(2, false);
-    __jsstr_set_char(final_str, 0, JS_CHAR_LEFT_SQUARE);
-    __jsstr_set_char(final_str, 1, JS_CHAR_RIGHT_SQUARE);
-  } else {
-    // 10.
-    __jsstring *left_square = __jsstr_get_builtin(JSBUILTIN_STRING_LEFT_SQUARE_CHAR);
-    __jsstring *right_square = __jsstr_get_builtin(JSBUILTIN_STRING_RIGHT_SQUARE_CHAR);
-    // 10.a
-    if (__jsstr_get_length(context->gap_str) == 0) {
-      // 10.a.i
-      __json_node *node = partial->first;
-      __jsstring *property = __jsval_to_string(&(node->value));
-      __jsstring *comma = __jsstr_get_builtin(JSBUILTIN_STRING_COMMA_CHAR);
-      node = node->next;
-      if (node) {
-        MAPLE_JS_ASSERT(__is_string(&(node->value)));
-        __jsstring *item = __jsval_to_string(&(node->value));
-        property = __jsstr_concat_3(property, comma, item);
-        node = node->next;
-        while (node) {
-          MAPLE_JS_ASSERT(__is_string(&(node->value)));
-          __jsstring *item = __jsval_to_string(&(node->value));
-          __jsstring *temp = __jsstr_concat_3(property, comma, item);
-          memory_manager->RecallString(property);
-          property = temp;
-          node = node->next;
-        }
-        final_str = __jsstr_concat_3(left_square, property, right_square);
-        memory_manager->RecallString(property);
-      } else {
-        // 10.a.ii
-        final_str = __jsstr_concat_3(left_square, property, right_square);
-      }
-    } else {
-      // 10.b
-      // 10.b.i
-      uint32_t len = __jsstr_get_length(context->indent_str);
-      __jsstring *sep = __js_new_string_internal(len + 2, false);
-      __jsstr_set_char(sep, 0, JS_CHAR_COMMA);
-      __jsstr_set_char(sep, 1, JS_CHAR_LF);
-      __jsstr_copy(sep, 2, context->indent_str);
-      // 10.b.ii
-      __json_node *node = partial->first;
-      __jsstring *property = __jsval_to_string(&(node->value));
-      node = node->next;
-      for (uint32_t i = 1; i < partial->count; i++) {
-        MAPLE_JS_ASSERT(__is_string(&(node->value)));
-        __jsstring *item = __jsval_to_string(&(node->value));
-        __jsstring *tmp = __jsstr_concat_3(property, sep, item);
-        memory_manager->RecallString(property);
-        property = tmp;
-        node = node->next;
-      }
-      memory_manager->RecallString(sep);
-      // 10.b.iii
-      __jsstring *left = __jsstr_append_char(left_square, JS_CHAR_LF);
-      __jsstring *tmp = __jsstr_concat_3(left, context->indent_str, property);
-      memory_manager->RecallString(left);
-      memory_manager->RecallString(property);
-      final_str = __jsstr_append_char(tmp, JS_CHAR_LF);
-      tmp = __jsstr_concat_3(final_str, step_back, right_square);
-      memory_manager->RecallString(final_str);
-      final_str = tmp;
-    }
-  }
+  // 9. 10.
+  final_str = __json_join_partial(partial, context, step_back, JS_CHAR_LEFT_SQUARE, JS_CHAR_RIGHT_SQUARE);
   memory_manager->RecallList(partial);
   // 11.
   __js_list_pop(context->stack);
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#include "jspropdict.h"
+#include "vmmemory.h"
+
+static __jsprop_dict_entry *__jsprop_dict_alloc_entries(uint32_t capacity) {
+  // VMMallocGC clears the memory, i.e. all entries are empty.
+  return (__jsprop_dict_entry *)VMMallocGC(capacity * sizeof(__jsprop_dict_entry));
+}
+
+__jsprop_dict *__jsprop_dict_new() {
+  __jsprop_dict *dict = (__jsprop_dict *)VMMallocGC(sizeof(__jsprop_dict));
+  dict->capacity = JSPROP_DICT_MIN_CAPACITY;
+  dict->count = 0;
+  dict->used = 0;
+  dict->entries = __jsprop_dict_alloc_entries(JSPROP_DICT_MIN_CAPACITY);
+  return dict;
+}
+
+void __jsprop_dict_free(__jsprop_dict *dict) {
+  memory_manager->RecallMem((void *)dict->entries, dict->capacity * sizeof(__jsprop_dict_entry));
+  memory_manager->RecallMem((void *)dict, sizeof(__jsprop_dict));
+}
+
+// Move the live entries to a table of CAPACITY entries, dropping tombstones.
+static void __jsprop_dict_rehash(__jsprop_dict *dict, uint32_t capacity) {
+  __jsprop_dict_entry *old_entries = dict->entries;
+  uint32_t old_capacity = dict->capacity;
+  uint32_t mask = capacity - 1;
+  dict->entries = __jsprop_dict_alloc_entries(capacity);
+  dict->capacity = capacity;
+  for (uint32_t j = 0; j < old_capacity; j++) {
+    __jsprop_dict_entry *e = &old_entries[j];
+    if (!e->name || e->name == JSPROP_DICT_TOMBSTONE) {
+      continue;
+    }
+    uint32_t i = __jsprop_dict_hash(e->name) & mask;
+    while (dict->entries[i].name) {
+      i = (i + 1) & mask;
+    }
+    dict->entries[i] = *e;
+  }
+  dict->used = dict->count;
+  memory_manager->RecallMem((void *)old_entries, old_capacity * sizeof(__jsprop_dict_entry));
+}
+
+void __jsprop_dict_put(__jsprop_dict *dict, __jsstring *name, __jsprop *prop) {
+  uint32_t mask = dict->capacity - 1;
+  __jsprop_dict_entry *tombstone = NULL;
+  uint32_t i = __jsprop_dict_hash(name) & mask;
+  for (;; i = (i + 1) & mask) {
+    __jsprop_dict_entry *e = &dict->entries[i];
+    if (e->name == name) {
+      e->prop = prop;
+      return;
+    }
+    if (!e->name) {
+      break;
+    }
+    if (e->name == JSPROP_DICT_TOMBSTONE && !tombstone) {
+      tombstone = e;
+    }
+  }
+  dict->count++;
+  if (tombstone) {
+    tombstone->name = name;
+    tombstone->prop = prop;
+    return;
+  }
+  dict->entries[i].name = name;
+  dict->entries[i].prop = prop;
+  // Keep the load, tombstones included, at most 3/4.
+  if (++dict->used * 4 > dict->capacity * 3) {
+    uint32_t capacity = dict->capacity;
+    while (dict->count * 2 > capacity) {
+      capacity <<= 1;
+    }
+    __jsprop_dict_rehash(dict, capacity);
+  }
+}
+
+__jsprop *__jsprop_dict_remove(__jsprop_dict *dict, __jsstring *name) {
+  uint32_t mask = dict->capacity - 1;
+  for (uint32_t i = __jsprop_dict_hash(name) & mask;; i = (i + 1) & mask) {
+    __jsprop_dict_entry *e = &dict->entries[i];
+    if (e->name == name) {
+      __jsprop *prop = e->prop;
+      e->name = JSPROP_DICT_TOMBSTONE;
+      e->prop = NULL;
+      dict->count--;
+      return prop;
+    }
+    if (!e->name) {
+      return NULL;
+    }
+  }
+}
@@ -13,6 +13,10 @@
  * See the MulanPSL - 2.0 for more details.
  */
 
+#include <cstdlib>
+#include <list>
+#include <unordered_map>
+#include <vector>
 #include "jsglobal.h"
 #include "jsvalue.h"
 #include "jsvalueinline.h"
@@ -21,21 +25,375 @@
 #include "jstycnv.h"
 #include "jscontext.h"
 #include "jsregexp.h"
+#include "jsstrsearch.h"
 #include "jsarray.h"
 #include "vmmemory.h"
 
 #define DEFAULT_REGEXP_PATTERN "(?:)"
 
-// Memory allocation for jscre.
+// Memory allocation for jscre. Compiled patterns are owned by their
+// __jsregexp_program, outside of the GC heap.
 static void* RegExpAlloc(size_t size) {
-  void *obj = VMMallocGC(size);
+  void *obj = malloc(size);
   MAPLE_JS_ASSERT(obj);
   return obj;
 }
 
 // Memory de-allocation for jscre.
 static void RegExpFree(void *ptr) {
-  // GC handles this.
+  free(ptr);
+}
+
+struct __jsregexp_cache_key {
+  __jsstring *source;
+  // JSREGEXP_FLAG_* that affect compilation.
+  uint8_t flags;
+};
+
+#define JSREGEXP_FLAG_IGNORECASE 0x1
+#define JSREGEXP_FLAG_MULTILINE 0x2
+// Longest subject kept converted between two execs, see GetUtf16Subject.
+#define JSREGEXP_SUBJECT_CACHE_MAX 0x10000
+
+struct __jsregexp_cache_key_hash {
+  size_t operator()(const __jsregexp_cache_key &key) const {
+    return __jsstr_hash(key.source) * 31 + key.flags;
+  }
+};
+
+struct __jsregexp_cache_key_equal {
+  bool operator()(const __jsregexp_cache_key &a, const __jsregexp_cache_key &b) const {
+    return a.flags == b.flags && __jsstr_equal(a.source, b.source);
+  }
+};
+
+typedef std::list<std::pair<__jsregexp_cache_key, __jsregexp_program *> > __jsregexp_lru_list;
+
+// The cache keeps a reference on its programs and on the sources of its keys.
+struct __jsregexp_cache {
+  // Most recently used first.
+  __jsregexp_lru_list lru;
+  std::unordered_map<__jsregexp_cache_key, __jsregexp_lru_list::iterator, __jsregexp_cache_key_hash,
+                     __jsregexp_cache_key_equal> index;
+};
+
+static __jsregexp_cache *__jsregexp_get_cache() {
+  static __jsregexp_cache *cache = new __jsregexp_cache();
+  return cache;
+}
+
+void __jsregexp_release_program(__jsregexp_program *program) {
+  MAPLE_JS_ASSERT(program->refcount > 0);
+  if (--program->refcount == 0) {
+    dart::jscre::jsRegExpFree(program->re, &RegExpFree);
+    if (program->literal) {
+      GCDecRf(program->literal);
+    }
+    delete program;
+  }
+}
+
+static inline int HexValue(uint16_t c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20;
+  return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// Parse the escape at *I of PATTERN, just after a backslash, that stands for
+// one code unit and advance *I past it. Return -1 for the other escapes.
+static int32_t ParseCharEscape(const std::vector<uint16_t> &pattern, size_t *i) {
+  uint16_t c = pattern[(*i)++];
+  switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case 'x':
+    case 'u': {
+      size_t digits = c == 'x' ? 2 : 4;
+      if (*i + digits > pattern.size()) {
+        return -1;
+      }
+      int32_t value = 0;
+      for (size_t k = 0; k < digits; k++) {
+        int d = HexValue(pattern[(*i)++]);
+        if (d < 0) {
+          return -1;
+        }
+        value = value * 16 + d;
+      }
+      return value;
+    }
+    default:
+      // Class escapes, assertions, back references and control escapes.
+      if (c < 128 && isalnum(c)) {
+        return -1;
+      }
+      return c;
+  }
+}
+
+static inline void ClassAdd(__jsregexp_class *cls, uint16_t c) {
+  cls->bits[c >> 3] |= 1 << (c & 7);
+}
+
+// Add the members of \d, \s or \w to CLS.
+static bool ClassAddEscape(__jsregexp_class *cls, uint16_t c) {
+  for (uint32_t u = 0; u < 256; u++) {
+    bool in;
+    switch (c) {
+      case 'd': in = u >= '0' && u <= '9'; break;
+      case 's': in = __js_isSpace(u); break;
+      case 'w': in = isalnum(u) || u == '_'; break;
+      default: return false;
+    }
+    if (in && (c != 'w' || u < 128)) {
+      ClassAdd(cls, u);
+    }
+  }
+  cls->unicode_space = cls->unicode_space || c == 's';
+  return true;
+}
+
+static inline bool ClassHas(const __jsregexp_class *cls, uint16_t c) {
+  bool in = c < 256 ? (cls->bits[c >> 3] >> (c & 7)) & 1 : cls->unicode_space && __js_isSpace(c);
+  return in != cls->negated;
+}
+
+// Recognize a literal pattern, see __jsregexp_kind.
+static bool AnalyzeLiteral(const std::vector<uint16_t> &pattern, std::vector<uint16_t> *literal) {
+  size_t i = 0;
+  while (i < pattern.size()) {
+    uint16_t c = pattern[i++];
+    switch (c) {
+      case '^': case '$': case '.': case '|': case '?': case '*': case '+':
+      case '(': case ')': case '[': case ']': case '{': case '}':
+        return false;
+      case '\\': {
+        if (i == pattern.size()) {
+          return false;
+        }
+        int32_t e = ParseCharEscape(pattern, &i);
+        if (e < 0) {
+          return false;
+        }
+        literal->push_back((uint16_t)e);
+        break;
+      }
+      default:
+        literal->push_back(c);
+    }
+  }
+  return !literal->empty();
+}
+
+// Recognize a character class pattern, see __jsregexp_kind.
+static bool AnalyzeClass(const std::vector<uint16_t> &pattern, __jsregexp_class *cls) {
+  memset(cls, 0, sizeof(__jsregexp_class));
+  size_t n = pattern.size();
+  size_t i = 0;
+  if (n >= 2 && pattern[0] == '\\') {
+    // \d, \s, \w and their complements.
+    uint16_t c = pattern[1];
+    uint16_t lower = c | 0x20;
+    if (!ClassAddEscape(cls, lower)) {
+      return false;
+    }
+    cls->negated = c != lower;
+    i = 2;
+  } else if (n >= 3 && pattern[0] == '[') {
+    i = 1;
+    if (pattern[i] == '^') {
+      cls->negated = true;
+      i++;
+    }
+    size_t first = i;
+    while (true) {
+      if (i == n) {
+        return false;
+      }
+      uint16_t c = pattern[i++];
+      if (c == ']' && i - 1 > first) {
+        break;
+      }
+      int32_t from = c;
+      if (c == '\\') {
+        if (i == n) {
+          return false;
+        }
+        uint16_t e = pattern[i];
+        if (e == 'd' || e == 's' || e == 'w') {
+          ClassAddEscape(cls, e);
+          i++;
+          continue;
+        }
+        // \b is a backspace in a class, nothing else is left to handle.
+        from = e == 'b' ? (i++, '\b') : ParseCharEscape(pattern, &i);
+      } else if (c == '[' || c == ']') {
+        return false;
+      }
+      int32_t to = from;
+      if (i + 1 < n && pattern[i] == '-' && pattern[i + 1] != ']') {
+        i++;
+        uint16_t d = pattern[i++];
+        if (d == '\\') {
+          if (i == n) {
+            return false;
+          }
+          to = pattern[i] == 'b' ? (i++, '\b') : ParseCharEscape(pattern, &i);
+        } else {
+          to = d == '[' ? -1 : d;
+        }
+      }
+      if (from < 0 || to < 0 || from > to || to > 255) {
+        return false;
+      }
+      for (int32_t u = from; u <= to; u++) {
+        ClassAdd(cls, u);
+      }
+    }
+  } else {
+    return false;
+  }
+  if (i < n && pattern[i] == '+') {
+    cls->repeated = true;
+    i++;
+  }
+  return i == n;
+}
+
+// Find out if PROGRAM, compiled from SOURCE, can be matched without jscre.
+static void AnalyzePattern(__jsregexp_program *program, __jsstring *source, bool ignorecase) {
+  program->kind = JSREGEXP_GENERAL;
+  program->literal = NULL;
+  if (ignorecase || program->num_captures != 0) {
+    return;
+  }
+  uint32_t len = __jsstr_get_length(source);
+  std::vector<uint16_t> pattern(len);
+  for (uint32_t i = 0; i < len; i++) {
+    pattern[i] = __jsstr_get_char(source, i);
+  }
+  std::vector<uint16_t> literal;
+  if (AnalyzeLiteral(pattern, &literal)) {
+    bool is_unicode = false;
+    for (uint32_t i = 0; i < literal.size(); i++) {
+      is_unicode = is_unicode || literal[i] > 0xff;
+    }
+    __jsstring *str = __js_new_string_internal(literal.size(), is_unicode);
+    for (uint32_t i = 0; i < literal.size(); i++) {
+      __jsstr_set_char(str, i, literal[i]);
+    }
+    GCIncRf(str);
+    program->literal = str;
+    program->kind = JSREGEXP_LITERAL;
+  } else if (AnalyzeClass(pattern, &program->cls)) {
+    program->kind = JSREGEXP_CLASS;
+  }
+}
+
+template <typename T>
+static int ExecuteClass(const __jsregexp_class *cls, const T *subject, int len, int start_offset, int *offsets) {
+  for (int i = start_offset; i < len; i++) {
+    if (ClassHas(cls, subject[i])) {
+      int end = i + 1;
+      if (cls->repeated) {
+        while (end < len && ClassHas(cls, subject[end])) {
+          end++;
+        }
+      }
+      offsets[0] = i;
+      offsets[1] = end;
+      return 1;
+    }
+  }
+  return dart::jscre::JSRegExpErrorNoMatch;
+}
+
+int __jsregexp_execute(__jsregexp_program *program, __jsstring *js_subject,
+                       int start_offset, int *offsets, int offset_count) {
+  MAPLE_JS_ASSERT(offset_count >= 2 || program->kind == JSREGEXP_GENERAL);
+  if (program->kind == JSREGEXP_LITERAL) {
+    int64_t start = __jsstr_find(js_subject, program->literal, start_offset);
+    if (start < 0) {
+      return dart::jscre::JSRegExpErrorNoMatch;
+    }
+    offsets[0] = (int)start;
+    offsets[1] = (int)start + __jsstr_get_length(program->literal);
+    return 1;
+  }
+  if (program->kind == JSREGEXP_CLASS) {
+    int len = __jsstr_get_length(js_subject);
+    if (__jsstr_is_ascii(js_subject)) {
+      return ExecuteClass(&program->cls, (const uint8_t *)__jsstr_get_ascii(js_subject), len, start_offset, offsets);
+    }
+    return ExecuteClass(&program->cls, __jsstr_get_utf16(js_subject), len, start_offset, offsets);
+  }
+  return RegExpExecute(program->re, js_subject, start_offset, offsets, offset_count);
+}
+
+__jsregexp_program *__jsregexp_get_program(__jsobject *obj, const char **error_message) {
+  MAPLE_JS_ASSERT(obj->object_class == JSREGEXP);
+  if (obj->shared.regexp) {
+    return obj->shared.regexp;
+  }
+  // 'source', 'ignoreCase' and 'multiline' are read-only, the program stays
+  // valid for the life of the object.
+  __jsvalue this_value = __object_value(obj);
+  __jsvalue source = __jsop_getprop_by_name(&this_value, __jsstr_get_builtin(JSBUILTIN_STRING_SOURCE));
+  __jsvalue js_ignorecase = __jsop_getprop_by_name(&this_value,
+                                                   __jsstr_get_builtin(JSBUILTIN_STRING_IGNORECASE_UL));
+  __jsvalue js_multiline = __jsop_getprop_by_name(&this_value, __jsstr_get_builtin(JSBUILTIN_STRING_MULTILINE));
+  bool ignorecase = __js_ToBoolean(&js_ignorecase);
+  bool multiline = __js_ToBoolean(&js_multiline);
+  __jsregexp_cache_key key;
+  key.source = __js_ToString(&source);
+  key.flags = (ignorecase ? JSREGEXP_FLAG_IGNORECASE : 0) | (multiline ? JSREGEXP_FLAG_MULTILINE : 0);
+
+  __jsregexp_cache *cache = __jsregexp_get_cache();
+  __jsregexp_program *program;
+  auto it = cache->index.find(key);
+  if (it != cache->index.end()) {
+    cache->lru.splice(cache->lru.begin(), cache->lru, it->second);
+    program = it->second->second;
+  } else {
+    unsigned num_captures;
+    dart::jscre::JSRegExp *re = RegExpCompile(key.source, ignorecase, multiline, &num_captures, error_message,
+                                              &RegExpAlloc, &RegExpFree);
+    if (re == NULL) {
+      return NULL;
+    }
+    program = new __jsregexp_program();
+    program->re = re;
+    program->num_captures = num_captures;
+    program->refcount = 1;
+    AnalyzePattern(program, key.source, ignorecase);
+    GCIncRf(key.source);
+    cache->lru.push_front(std::make_pair(key, program));
+    cache->index[key] = cache->lru.begin();
+    if (cache->lru.size() > JSREGEXP_CACHE_SIZE) {
+      std::pair<__jsregexp_cache_key, __jsregexp_program *> victim = cache->lru.back();
+      cache->index.erase(victim.first);
+      cache->lru.pop_back();
+      GCDecRf(victim.first.source);
+      __jsregexp_release_program(victim.second);
+    }
+  }
+  program->refcount++;
+  obj->shared.regexp = program;
+  return program;
+}
+
+__jsregexp_program *__jsregexp_get_exec_program(__jsobject *obj) {
+  const char *error_message = NULL;
+  __jsregexp_program *program = __jsregexp_get_program(obj, &error_message);
+  if (program == NULL && !strstr(error_message, "at end of pattern")) {
+    MAPLE_JS_SYNTAXERROR_EXCEPTION();
+  }
+  return program;
 }
 
 // Convert char array to 2-byte integer array.
@@ -278,13 +636,9 @@ __jsvalue __js_new_regexp_obj(__jsvalue *this_value, __jsvalue *arg_list,
   __jsobj_helper_init_value_property(obj, JSBUILTIN_STRING_LASTINDEX_UL,
                                        &js_last_index, JSPROP_DESC_HAS_VWUEUC);
 
-  // Compile pattern and store 'source'.
-  unsigned num_captures;
+  // Compile the pattern now to report syntax errors.
   const char *error_message = NULL;
-
-  dart::jscre::JSRegExp * regexp = RegExpCompile(js_pattern, ignorecase,
-          multiline, &num_captures, &error_message, &RegExpAlloc, &RegExpFree);
-  if (regexp == NULL) {
+  if (__jsregexp_get_program(obj, &error_message) == NULL) {
     MAPLE_JS_SYNTAXERROR_EXCEPTION();
   }
 
@@ -303,27 +657,14 @@ __jsvalue __jsregexp_Exec(__jsvalue *this_value, __jsvalue *value, uint32_t narg
     MAPLE_JS_TYPEERROR_EXCEPTION();
   }
 
-  __jsstring *js_pattern;
-
-  // Retrieve propereties from this RegExp object.
-  bool global = false, ignorecase = false, multiline = false;
-
-  __jsvalue source = __jsop_getprop_by_name(this_value,
-                        __jsstr_get_builtin(JSBUILTIN_STRING_SOURCE));
-  js_pattern = __js_ToString(&source);
+  // Retrieve propereties from this RegExp object, the others are compiled
+  // into its program.
+  bool global = false;
 
   __jsvalue js_global = __jsop_getprop_by_name(this_value,
                         __jsstr_get_builtin(JSBUILTIN_STRING_GLOBAL));
   global = __js_ToBoolean(&js_global);
 
-  __jsvalue js_ignorecase = __jsop_getprop_by_name(this_value,
-                  __jsstr_get_builtin(JSBUILTIN_STRING_IGNORECASE_UL));
-  ignorecase = __js_ToBoolean(&js_ignorecase);
-
-  __jsvalue js_multiline = __jsop_getprop_by_name(this_value,
-                      __jsstr_get_builtin(JSBUILTIN_STRING_MULTILINE));
-  multiline = __js_ToBoolean(&js_multiline);
-
   int last_index;
   __jsvalue js_last_index;
   js_last_index = __jsop_getprop_by_name(this_value,
@@ -333,19 +674,10 @@ __jsvalue __jsregexp_Exec(__jsvalue *this_value, __jsvalue *value, uint32_t narg
   if (last_index < 0)
     last_index = 0;
 
-  unsigned num_captures;
-  const char *error_message = NULL;
-
-  // Compile RegExp pattern.
-  dart::jscre::JSRegExp * regexp = RegExpCompile(js_pattern, ignorecase,
-          multiline, &num_captures, &error_message, &RegExpAlloc, &RegExpFree);
-
-  if (regexp == NULL) {
-    if (strstr(error_message, "at end of pattern")) {
-      return __null_value();
-    } else {
-      MAPLE_JS_SYNTAXERROR_EXCEPTION();
-    }
+  // Compiled RegExp pattern.
+  __jsregexp_program *program = __jsregexp_get_exec_program(obj);
+  if (program == NULL) {
+    return __null_value();
   }
 
   // Prepare subject.
@@ -369,12 +701,16 @@ __jsvalue __jsregexp_Exec(__jsvalue *this_value, __jsvalue *value, uint32_t narg
   }
 
   int start_offset = global ? last_index : 0;
-  int *offsets = (int *) VMMallocGC((num_captures+1) * 3);
+  unsigned num_captures = program->num_captures;
   int offset_count = (num_captures+1) * 3;
+  std::vector<int> offsets(offset_count);
 
   // Do RegExp execution.
-  int res = RegExpExecute(regexp, js_subject, start_offset, offsets,
-                          offset_count);
+  int res = __jsregexp_execute(program, js_subject, start_offset, offsets.data(),
+                               offset_count);
+  if (__jsstr_get_length(js_subject) > JSREGEXP_SUBJECT_CACHE_MAX || __jsstr_is_dependent(js_subject)) {
+    __jsregexp_release_subject();
+  }
 
   if (res == dart::jscre::JSRegExpErrorNoMatch ||
       res == dart::jscre::JSRegExpErrorHitLimit) {
@@ -535,9 +871,9 @@ dart::jscre::JSRegExp *RegExpCompile(__jsstring *js_pattern,
   int len = __jsstr_get_length(js_pattern);
   uint16_t pattern[len];
   if (__jsstr_is_ascii(js_pattern)) {
-    StrToUint16(js_pattern->x.ascii, pattern, len);
+    StrToUint16(__jsstr_get_ascii(js_pattern), pattern, len);
   } else {
-    memcpy(pattern, js_pattern->x.utf16, len * sizeof(uint16_t));
+    memcpy(pattern, __jsstr_get_utf16(js_pattern), len * sizeof(uint16_t));
   }
 
   dart::jscre::JSRegExpIgnoreCaseOption case_option = ignorecase ?
@@ -553,16 +889,57 @@ dart::jscre::JSRegExp *RegExpCompile(__jsstring *js_pattern,
   return regexp;
 }
 
+// jscre only matches utf16 code units. The last ascii subject is kept
+// converted, as global matches and replaces execute on the same subject
+// repeatedly. The cache holds a reference on the subject so that its address
+// can't be reused by another string, until __jsregexp_release_subject.
+// Between two execs from a script it only keeps subjects of at most
+// JSREGEXP_SUBJECT_CACHE_MAX code units which don't pin the parent of a
+// substring.
+static __jsstring *wide_subject = NULL;
+static std::vector<uint16_t> *wide_subject_units = NULL;
+
+static const uint16_t *GetUtf16Subject(__jsstring *js_subject) {
+  if (!__jsstr_is_ascii(js_subject)) {
+    return __jsstr_get_utf16(js_subject);
+  }
+  if (!wide_subject_units) {
+    wide_subject_units = new std::vector<uint16_t>();
+  }
+  if (js_subject != wide_subject) {
+    uint32_t len = __jsstr_get_length(js_subject);
+    // Don't hold on to the buffer of a much longer subject.
+    if (wide_subject_units->capacity() > 4 * (size_t)len) {
+      std::vector<uint16_t>().swap(*wide_subject_units);
+    }
+    wide_subject_units->resize(len + 1);
+    StrToUint16(__jsstr_get_ascii(js_subject), wide_subject_units->data(), len);
+    GCIncRf(js_subject);
+    __jsstring *old = wide_subject;
+    wide_subject = js_subject;
+    if (old) {
+      GCDecRf(old);
+    }
+  }
+  return wide_subject_units->data();
+}
+
+void __jsregexp_release_subject() {
+  if (wide_subject) {
+    // The caller may still be using the subject.
+    GCDecRfNoRecall(wide_subject);
+    wide_subject = NULL;
+  }
+  if (wide_subject_units && wide_subject_units->capacity() > JSREGEXP_SUBJECT_CACHE_MAX) {
+    std::vector<uint16_t>().swap(*wide_subject_units);
+  }
+}
+
 // Do RegExp execution.
 int RegExpExecute(const dart::jscre::JSRegExp *re, __jsstring *js_subject,
                   int start_offset, int *offsets, int offset_count) {
   int len = __jsstr_get_length(js_subject);
-  uint16_t subject[len];
-  if (__jsstr_is_ascii(js_subject)) {
-    StrToUint16(js_subject->x.ascii, subject, len);
-  } else {
-    memcpy(subject, js_subject->x.utf16, len*sizeof(uint16_t));
-  }
+  const uint16_t *subject = GetUtf16Subject(js_subject);
   int res = dart::jscre::jsRegExpExecute(re, subject, len,
                                          start_offset, offsets, offset_count);
 
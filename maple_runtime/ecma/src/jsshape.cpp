@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#include "jsshape.h"
+#include "vmmemory.h"
+
+static __jsshape *__jsshape_root = NULL;
+
+static __jsshape *__jsshape_new(__jsshape *parent, uint32_t slot_count) {
+  __jsshape *shape = new __jsshape();
+  shape->parent = parent;
+  shape->names = slot_count ? new __jsstring *[slot_count] : NULL;
+  shape->slot_count = slot_count;
+  shape->num_transitions = 0;
+  shape->first_child = NULL;
+  shape->next_sibling = NULL;
+  return shape;
+}
+
+__jsshape *__jsshape_get_root() {
+  if (!__jsshape_root) {
+    __jsshape_root = __jsshape_new(NULL, 0);
+  }
+  return __jsshape_root;
+}
+
+__jsshape *__jsshape_add_transition(__jsshape *shape, __jsstring *name) {
+  name = __jsstr_intern(name);
+  for (__jsshape *child = shape->first_child; child; child = child->next_sibling) {
+    if (child->names[shape->slot_count] == name) {
+      return child;
+    }
+  }
+  if (shape->slot_count >= JSSHAPE_MAX_SLOTS || shape->num_transitions >= JSSHAPE_MAX_TRANSITIONS) {
+    return NULL;
+  }
+  __jsshape *child = __jsshape_new(shape, shape->slot_count + 1);
+  for (uint32_t i = 0; i < shape->slot_count; i++) {
+    child->names[i] = shape->names[i];
+  }
+  // The shape tree lives as long as the VM, keep the name alive with it.
+  GCIncRf(name);
+  child->names[shape->slot_count] = name;
+  child->next_sibling = shape->first_child;
+  shape->first_child = child;
+  shape->num_transitions++;
+  return child;
+}
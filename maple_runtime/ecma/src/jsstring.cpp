@@ -21,11 +21,14 @@
 #include <ctype.h>
 #include <string>
 #include <codecvt>
+#include <unordered_set>
+#include <vector>
 #include "jsvalue.h"
 #include "jsvalueinline.h"
 #include "jsobject.h"
 #include "jsobjectinline.h"
 #include "jsstring.h"
+#include "jsstrsearch.h"
 #include "jsnum.h"
 #include "vmmemory.h"
 #include "jsarray.h"
@@ -55,13 +58,14 @@ std::wstring __jsstr_to_wstring(__jsstring *s, int offset) {
   }
   if (__jsstr_is_ascii(s)) {
     std::string str8;
-    str8.assign(s->x.ascii + offset, len);
+    str8.assign(__jsstr_get_ascii(s) + offset, len);
     std::wstring_convert<std::codecvt_utf8<wchar_t>,wchar_t> cv;
     return cv.from_bytes(str8);
   } else {
     wchar_t buf[len + 1];
+    uint16_t *chars = __jsstr_get_utf16(s);
     for (uint32_t i = 0; i < len; i++) {
-      buf[i] = (wchar_t)((uint16_t *)s)[2 + i + offset];
+      buf[i] = (wchar_t)chars[i + offset];
     }
     buf[len] = 0;
     std::wstring str32;
@@ -80,37 +84,39 @@ bool __is_UnicodeSpace(wchar_t c) {
 
 void __jsstr_set_char(__jsstring *str, uint32_t index, uint16_t ch) {
   if (__jsstr_is_ascii(str)) {
-    ((uint8_t *)str)[4 + index] = (uint8_t)ch;
+    ((uint8_t *)__jsstr_get_ascii(str))[index] = (uint8_t)ch;
   } else {
-    ((uint16_t *)str)[2 + index] = (uint16_t)ch;
+    __jsstr_get_utf16(str)[index] = (uint16_t)ch;
   }
 }
 
 uint32_t __jsstr_get_bytesize(__jsstring *str) {
+  if (__jsstr_is_rope(str)) {
+    return sizeof(__jsstring_rope);
+  }
+  if (__jsstr_is_dependent(str)) {
+    return sizeof(__jsstring_dep);
+  }
   uint32_t length = __jsstr_get_length(str);
   uint32_t uni_size = __jsstr_is_ascii(str) ? 1 : 2;
-  return (uni_size * length + 4);
+  return (uni_size * length + __jsstr_header_size(str));
 }
 
 uint16_t __jsstr_get_char(__jsstring *str, uint32_t index) {
   if (__jsstr_is_ascii(str)) {
-    uint8_t *chars;
-    chars = &((uint8_t *)str)[4];
-    return chars[index];
+    return ((uint8_t *)__jsstr_get_ascii(str))[index];
   } else {
-    uint16_t *chars;
-    chars = &((uint16_t *)str)[2];
-    return chars[index];
+    return __jsstr_get_utf16(str)[index];
   }
 }
 
 void __jsstr_print(__jsstring *str, FILE *stream) {
   uint32_t length = __jsstr_get_length(str);
   if(__jsstr_is_ascii(str))
-      std::fprintf(stream, "%.*s", length, str->x.ascii);
+      std::fprintf(stream, "%.*s", length, __jsstr_get_ascii(str));
   else {
       std::u16string u16str;
-      u16str.assign(reinterpret_cast<std::u16string::const_pointer>(str->x.utf16), length);
+      u16str.assign(reinterpret_cast<std::u16string::const_pointer>(__jsstr_get_utf16(str)), length);
       std::string u8str = std::wstring_convert<std::codecvt_utf8_utf16<char16_t>,
           char16_t>{}.to_bytes(u16str);
       std::fprintf(stream, "%s", u8str.c_str());
@@ -133,9 +139,9 @@ void __jsstr_dump(__jsstring *str) {
 }
 
 __jsstring *__js_new_string_internal(uint32_t length, bool is_unicode) {
-  MAPLE_JS_ASSERT(length < 0x10000 && "Donot support too long string");
   uint32_t unit_size = is_unicode ? 2 : 1;
-  uint32_t total_size = (unit_size * length + 4);
+  MAPLE_JS_ASSERT(length <= (UINT32_MAX - sizeof(__jsstring_gen)) / unit_size && "Donot support too long string");
+  uint32_t total_size = (unit_size * length + sizeof(__jsstring_gen));
   __jsstring *str = (__jsstring *)VMMallocGC(total_size, MemHeadJSString, false);
   __jsstring_type cl;
   if (is_unicode)
@@ -144,7 +150,9 @@ __jsstring *__js_new_string_internal(uint32_t length, bool is_unicode) {
       cl = JSSTRING_GEN;
   str->kind = cl;
   str->builtin = (__jsbuiltin_string_id)0;
-  str->length = (uint16_t)length;
+  str->length = 0;
+  ((__jsstring_gen *)str)->length = length;
+  ((__jsstring_gen *)str)->hash = 0;
   return str;
 }
 
@@ -195,6 +203,13 @@ bool __jsstr_equal(__jsstring *str1, __jsstring *str2, bool checknumber) {
   if (length != __jsstr_get_length(str2)) {
     return false;
   }
+  if (__jsstr_is_gen(str1) && __jsstr_is_gen(str2)) {
+    uint32_t hash1 = ((__jsstring_gen *)str1)->hash;
+    uint32_t hash2 = ((__jsstring_gen *)str2)->hash;
+    if (hash1 && hash2 && hash1 != hash2) {
+      return false;
+    }
+  }
   for (uint32_t i = 0; i < length; i++) {
     if (__jsstr_get_char(str1, i) != __jsstr_get_char(str2, i)) {
       return false;
@@ -215,20 +230,156 @@ bool __jsstr_equal(__jsstring *str1, __jsstring *str2, bool checknumber) {
   return true;
 }
 
+// FNV-1a over the code units, so that ascii and unicode strings with the same
+// content hash the same, as __jsstr_equal compares them equal.
+// The hash is cached in generated strings, where 0 stands for not computed yet.
+uint32_t __jsstr_hash(__jsstring *str) {
+  if (__jsstr_is_gen(str) && ((__jsstring_gen *)str)->hash) {
+    return ((__jsstring_gen *)str)->hash;
+  }
+  uint32_t length = __jsstr_get_length(str);
+  uint32_t h = 2166136261u;
+  if (__jsstr_is_ascii(str)) {
+    const uint8_t *chars = (const uint8_t *)__jsstr_get_ascii(str);
+    for (uint32_t i = 0; i < length; i++) {
+      h = (h ^ chars[i]) * 16777619u;
+    }
+  } else {
+    const uint16_t *chars = __jsstr_get_utf16(str);
+    for (uint32_t i = 0; i < length; i++) {
+      h = (h ^ chars[i]) * 16777619u;
+    }
+  }
+  if (h == 0) {
+    h = 1;
+  }
+  if (__jsstr_is_gen(str)) {
+    ((__jsstring_gen *)str)->hash = h;
+  }
+  return h;
+}
+
+struct __jsstr_atom_hash {
+  size_t operator()(__jsstring *str) const {
+    return __jsstr_hash(str);
+  }
+};
+
+struct __jsstr_atom_equal {
+  bool operator()(__jsstring *str1, __jsstring *str2) const {
+    return __jsstr_equal(str1, str2);
+  }
+};
+
+typedef std::unordered_set<__jsstring *, __jsstr_atom_hash, __jsstr_atom_equal> __jsstr_atom_set;
+
+static __jsstr_atom_set *__jsstr_get_atoms() {
+  static __jsstr_atom_set *atoms = NULL;
+  if (!atoms) {
+    atoms = new __jsstr_atom_set(2 * JSBUILTIN_STRING_LAST);
+    // Builtin strings are the atoms of their content, so that names built at
+    // run time resolve to the same pointer as the builtin ones.
+    for (uint32_t i = 0; i < JSBUILTIN_STRING_LAST; i++) {
+      atoms->insert(__jsstr_get_builtin((__jsbuiltin_string_id)i));
+    }
+  }
+  return atoms;
+}
+
+__jsstring *__jsstr_intern(__jsstring *str) {
+  if (str->kind & JSSTRING_ATOM) {
+    return str;
+  }
+  if (__jsstr_is_dependent(str)) {
+    // Atoms live as long as the properties named by them, don't let one pin
+    // the parent of a substring.
+    __jsstring *atom = __jsstr_lookup_atom(str);
+    if (atom) {
+      return atom;
+    }
+    __jsstring *copy = __js_new_string_internal(__jsstr_get_length(str), !__jsstr_is_ascii(str));
+    __jsstr_copy(copy, 0, str);
+    ((__jsstring_gen *)copy)->hash = ((__jsstring_gen *)str)->hash;
+    str = copy;
+  }
+  std::pair<__jsstr_atom_set::iterator, bool> res = __jsstr_get_atoms()->insert(str);
+  // Only heap strings are flagged, constant strings are never released.
+  if (res.second && memory_manager->IsHeap(str)) {
+    str->kind = (__jsstring_type)(str->kind | JSSTRING_ATOM);
+  }
+  return *res.first;
+}
+
+// Names up to this length are probed with a string on the stack, longer ones
+// are allocated first.
+#define JSSTR_INTERN_PROBE_MAX 64
+
+__jsstring *__jsstr_intern_ascii(const char *chars, uint32_t length) {
+  if (length > JSSTR_INTERN_PROBE_MAX) {
+    __jsstring *str = __js_new_string_internal(length, false);
+    memcpy(__jsstr_get_ascii(str), chars, length);
+    __jsstring *atom = __jsstr_intern(str);
+    if (atom != str) {
+      memory_manager->RecallString(str);
+    }
+    return atom;
+  }
+  // Probe with a string on the stack before allocating one.
+  union {
+    __jsstring_gen gen;
+    uint8_t bytes[sizeof(__jsstring_gen) + JSSTR_INTERN_PROBE_MAX];
+  } buf;
+  __jsstring_gen *key = &buf.gen;
+  key->head.kind = JSSTRING_GEN;
+  key->head.builtin = (__jsbuiltin_string_id)0;
+  key->head.length = 0;
+  key->length = length;
+  key->hash = 0;
+  memcpy(__jsstr_get_ascii(&key->head), chars, length);
+  __jsstring *atom = __jsstr_lookup_atom(&key->head);
+  if (atom) {
+    return atom;
+  }
+  __jsstring *str = __js_new_string_internal(length, false);
+  memcpy(__jsstr_get_ascii(str), chars, length);
+  // The hash is already known.
+  ((__jsstring_gen *)str)->hash = key->hash;
+  return __jsstr_intern(str);
+}
+
+__jsstring *__jsstr_lookup_atom(__jsstring *str) {
+  if (str->kind & JSSTRING_ATOM) {
+    return str;
+  }
+  __jsstr_atom_set *atoms = __jsstr_get_atoms();
+  __jsstr_atom_set::iterator it = atoms->find(str);
+  return it == atoms->end() ? NULL : *it;
+}
+
+void __jsstr_remove_atom(__jsstring *str) {
+  __jsstr_atom_set *atoms = __jsstr_get_atoms();
+  __jsstr_atom_set::iterator it = atoms->find(str);
+  if (it != atoms->end() && *it == str) {
+    atoms->erase(it);
+  }
+}
+
 void __jsstr_copy_ascii(__jsstring *to, uint32_t to_index, __jsstring *from) {
   uint32_t len = __jsstr_get_length(from);
-  memcpy(&(((uint8_t *)to)[4 + to_index]), &(((uint8_t *)from)[4]), len);
+  memcpy(__jsstr_get_ascii(to) + to_index, __jsstr_get_ascii(from), len);
 }
 
 void __jsstr_copy_unicode(__jsstring *to, uint32_t to_index, __jsstring *from) {
   uint32_t len = __jsstr_get_length(from);
-  memcpy(&(((uint16_t *)to)[2 + to_index]), &(((uint16_t *)from)[2]), len * sizeof(uint16_t));
+  memcpy(__jsstr_get_utf16(to) + to_index, __jsstr_get_utf16(from), len * sizeof(uint16_t));
 }
 
 void __jsstr_copy_ascii_to_unicode(__jsstring *to, uint32_t to_index, __jsstring *from) {
   uint32_t len = __jsstr_get_length(from);
+  uint16_t *to_chars = __jsstr_get_utf16(to) + to_index;
+  uint8_t *from_chars = (uint8_t *)__jsstr_get_ascii(from);
   for (uint32_t i = 0; i < len; i++) {
-    ((uint16_t *)to)[2 + to_index + i] = ((uint8_t *)from)[4 + i];
+    to_chars[i] = from_chars[i];
   }
 }
 
@@ -245,16 +396,159 @@ void __jsstr_copy(__jsstring *to, uint32_t to_index, __jsstring *from) {
 }
 
 __jsstring *__jsstr_extract(__jsstring *from, uint32_t from_index, uint32_t length) {
-  __jsstring *res;
-  if (__jsstr_is_ascii(from)) {
-    res = __js_new_string_internal(length, false);
+  bool is_unicode = !__jsstr_is_ascii(from);
+  uint32_t unit_size = is_unicode ? 2 : 1;
+  // Share the code units of the flat string underneath FROM.
+  __jsstring *parent = from;
+  uint32_t offset = from_index;
+  if (__jsstr_is_rope(parent)) {
+    parent = __jsstr_flatten(parent);
+  } else if (__jsstr_is_dependent(parent)) {
+    offset += ((__jsstring_dep *)parent)->offset;
+    parent = ((__jsstring_dep *)parent)->parent;
+  }
+  if (length >= JSSTRING_DEPENDENT_MIN_LENGTH &&
+      (!memory_manager->IsHeap(parent) ||
+       (uint64_t)length * JSSTRING_DEPENDENT_MAX_RATIO >= __jsstr_get_length(parent))) {
+    __jsstring_dep *dep = (__jsstring_dep *)VMMallocGC(sizeof(__jsstring_dep), MemHeadJSString, false);
+    uint8_t kind = JSSTRING_GEN | JSSTRING_DEPENDENT;
+    if (is_unicode) {
+      kind |= JSSTRING_UNICODE;
+    }
+    dep->gen.head.kind = (__jsstring_type)kind;
+    dep->gen.head.builtin = (__jsbuiltin_string_id)0;
+    dep->gen.head.length = 0;
+    dep->gen.length = length;
+    dep->gen.hash = 0;
+    GCIncRf(parent);
+    dep->parent = parent;
+    dep->offset = offset;
+    return (__jsstring *)dep;
+  }
+  __jsstring *res = __js_new_string_internal(length, is_unicode);
+  char *from_chars = (char *)parent + __jsstr_header_size(parent) + offset * unit_size;
+  memcpy((char *)res + sizeof(__jsstring_gen), from_chars, length * unit_size);
+  return res;
+}
+
+void *__jsstr_get_chars_slow(__jsstring *str) {
+  if (__jsstr_is_rope(str)) {
+    str = __jsstr_flatten(str);
+    return (char *)str + __jsstr_header_size(str);
+  }
+  __jsstring_dep *dep = (__jsstring_dep *)str;
+  __jsstring *parent = dep->parent;
+  uint32_t unit_size = __jsstr_is_ascii(parent) ? 1 : 2;
+  return (char *)parent + __jsstr_header_size(parent) + dep->offset * unit_size;
+}
+
+#define JSSTR_BUILDER_MIN_CAPACITY 16
+
+__jsstr_builder::~__jsstr_builder() {
+  if (buf) {
+    memory_manager->RecallString(buf);
+  }
+}
+
+// Make room for NEEDED more code units, in a unicode buffer if IS_UNICODE.
+static void __jsstr_builder_reserve(__jsstr_builder *builder, uint32_t needed, bool is_unicode) {
+  __jsstring *buf = builder->buf;
+  uint32_t capacity = buf ? __jsstr_get_length(buf) : 0;
+  bool buf_unicode = buf && !__jsstr_is_ascii(buf);
+  MAPLE_JS_ASSERT(needed <= UINT32_MAX / 4 - builder->length && "Donot support too long string");
+  uint32_t wanted = builder->length + needed;
+  if (wanted <= capacity && (buf_unicode || !is_unicode)) {
+    return;
+  }
+  uint32_t new_capacity = capacity < JSSTR_BUILDER_MIN_CAPACITY ? JSSTR_BUILDER_MIN_CAPACITY : capacity;
+  while (new_capacity < wanted) {
+    new_capacity *= 2;
+  }
+  if (buf && (buf_unicode || !is_unicode)) {
+    uint32_t unit_size = buf_unicode ? 2 : 1;
+    buf = (__jsstring *)VMReallocGC(buf, unit_size * capacity + sizeof(__jsstring_gen),
+                                    unit_size * new_capacity + sizeof(__jsstring_gen), false);
+    ((__jsstring_gen *)buf)->length = new_capacity;
+    builder->buf = buf;
+    return;
+  }
+  // First allocation, or promotion of the ascii code units to unicode.
+  __jsstring *new_buf = __js_new_string_internal(new_capacity, buf_unicode || is_unicode);
+  if (buf) {
+    uint8_t *from = (uint8_t *)__jsstr_get_ascii(buf);
+    uint16_t *to = __jsstr_get_utf16(new_buf);
+    for (uint32_t i = 0; i < builder->length; i++) {
+      to[i] = from[i];
+    }
+    memory_manager->RecallString(buf);
+  }
+  builder->buf = new_buf;
+}
+
+void __jsstr_builder_append_char(__jsstr_builder *builder, uint16_t ch) {
+  __jsstr_builder_reserve(builder, 1, ch > 0x7f);
+  __jsstr_set_char(builder->buf, builder->length++, ch);
+}
+
+void __jsstr_builder_append_ascii(__jsstr_builder *builder, const char *chars, uint32_t length) {
+  __jsstr_builder_reserve(builder, length, false);
+  __jsstring *buf = builder->buf;
+  if (__jsstr_is_ascii(buf)) {
+    memcpy(__jsstr_get_ascii(buf) + builder->length, chars, length);
   } else {
-    res = __js_new_string_internal(length, true);
+    uint16_t *to = __jsstr_get_utf16(buf) + builder->length;
+    for (uint32_t i = 0; i < length; i++) {
+      to[i] = (uint8_t)chars[i];
+    }
   }
-  for (uint32_t i = 0; i < length; i++) {
-    __jsstr_set_char(res, i, __jsstr_get_char(from, from_index + i));
+  builder->length += length;
+}
+
+void __jsstr_builder_append(__jsstr_builder *builder, __jsstring *str) {
+  uint32_t length = __jsstr_get_length(str);
+  if (length == 0) {
+    return;
   }
-  return res;
+  __jsstr_builder_reserve(builder, length, !__jsstr_is_ascii(str));
+  __jsstr_copy(builder->buf, builder->length, str);
+  builder->length += length;
+}
+
+void __jsstr_builder_append_range(__jsstr_builder *builder, __jsstring *str, uint32_t from, uint32_t length) {
+  if (length == 0) {
+    return;
+  }
+  bool is_ascii = __jsstr_is_ascii(str);
+  __jsstr_builder_reserve(builder, length, !is_ascii);
+  __jsstring *buf = builder->buf;
+  if (!is_ascii) {
+    memcpy(__jsstr_get_utf16(buf) + builder->length, __jsstr_get_utf16(str) + from, length * 2);
+    builder->length += length;
+    return;
+  }
+  __jsstr_builder_append_ascii(builder, __jsstr_get_ascii(str) + from, length);
+}
+
+__jsstring *__jsstr_builder_finish(__jsstr_builder *builder) {
+  __jsstring *buf = builder->buf;
+  uint32_t length = builder->length;
+  builder->buf = NULL;
+  builder->length = 0;
+  if (length == 0) {
+    if (buf) {
+      memory_manager->RecallString(buf);
+    }
+    return __jsstr_get_builtin(JSBUILTIN_STRING_EMPTY);
+  }
+  uint32_t capacity = __jsstr_get_length(buf);
+  if (length < capacity) {
+    // Give the unused code units back, the size of a string follows its length.
+    uint32_t unit_size = __jsstr_is_ascii(buf) ? 1 : 2;
+    buf = (__jsstring *)VMReallocGC(buf, unit_size * capacity + sizeof(__jsstring_gen),
+                                    unit_size * length + sizeof(__jsstring_gen), false);
+    ((__jsstring_gen *)buf)->length = length;
+  }
+  return buf;
 }
 
 __jsstring *__jsstr_append_char(__jsstring *str, const __jschar ch) {
@@ -272,10 +566,97 @@ __jsstring *__jsstr_append_char(__jsstring *str, const __jschar ch) {
   return str1;
 }
 
+// Allocate a rope of LEFT and RIGHT, on which the caller took references.
+static __jsstring *__jsstr_new_rope_node(__jsstring *left, __jsstring *right) {
+  __jsstring_rope *rope = (__jsstring_rope *)VMMallocGC(sizeof(__jsstring_rope), MemHeadJSString, false);
+  uint8_t kind = JSSTRING_GEN | JSSTRING_ROPE;
+  if (!__jsstr_is_ascii(left) || !__jsstr_is_ascii(right)) {
+    kind |= JSSTRING_UNICODE;
+  }
+  rope->gen.head.kind = (__jsstring_type)kind;
+  rope->gen.head.builtin = (__jsbuiltin_string_id)0;
+  rope->gen.head.length = 0;
+  rope->gen.length = __jsstr_get_length(left) + __jsstr_get_length(right);
+  rope->gen.hash = 0;
+  rope->left = left;
+  rope->right = right;
+  rope->flat = NULL;
+  return (__jsstring *)rope;
+}
+
+// Return the string a rope keeps for its operand STR, with a reference taken
+// on it. A heap string without references is only borrowed by the caller,
+// which may go on using it, or recall it, after the rope released it: the
+// rope keeps a copy of it then. Only the node of such a rope is copied, its
+// children are referenced by it already.
+static __jsstring *__jsstr_rope_operand(__jsstring *str) {
+  if (memory_manager->IsHeap(str) && memory_manager->GetMemHeader(str).refcount == 0) {
+    if (__jsstr_is_rope(str)) {
+      __jsstring_rope *rope = (__jsstring_rope *)str;
+      if (rope->flat) {
+        str = rope->flat;
+      } else {
+        GCIncRf(rope->left);
+        GCIncRf(rope->right);
+        str = __jsstr_new_rope_node(rope->left, rope->right);
+      }
+    } else {
+      __jsstring *copy = __js_new_string_internal(__jsstr_get_length(str), !__jsstr_is_ascii(str));
+      __jsstr_copy(copy, 0, str);
+      str = copy;
+    }
+  }
+  GCIncRf(str);
+  return str;
+}
+
+static __jsstring *__jsstr_new_rope(__jsstring *left, __jsstring *right) {
+  left = __jsstr_rope_operand(left);
+  right = __jsstr_rope_operand(right);
+  return __jsstr_new_rope_node(left, right);
+}
+
+__jsstring *__jsstr_flatten(__jsstring *str) {
+  __jsstring_rope *rope = (__jsstring_rope *)str;
+  if (rope->flat) {
+    return rope->flat;
+  }
+  __jsstring *flat = __js_new_string_internal(rope->gen.length, !__jsstr_is_ascii(str));
+  // Ropes built by a loop of += are as deep as the loop is long, walk them
+  // without recursion.
+  std::vector<std::pair<__jsstring *, uint32_t> > work;
+  work.push_back(std::make_pair(str, 0u));
+  while (!work.empty()) {
+    __jsstring *node = work.back().first;
+    uint32_t offset = work.back().second;
+    work.pop_back();
+    __jsstring_rope *node_rope = (__jsstring_rope *)node;
+    if (__jsstr_is_rope(node) && !node_rope->flat) {
+      work.push_back(std::make_pair(node_rope->right, offset + __jsstr_get_length(node_rope->left)));
+      work.push_back(std::make_pair(node_rope->left, offset));
+    } else {
+      __jsstr_copy(flat, offset, node);
+    }
+  }
+  ((__jsstring_gen *)flat)->hash = rope->gen.hash;
+  GCIncRf(flat);
+  rope->flat = flat;
+  __jsstring *left = rope->left;
+  __jsstring *right = rope->right;
+  rope->left = NULL;
+  rope->right = NULL;
+  GCDecRf(left);
+  GCDecRf(right);
+  return flat;
+}
+
 __jsstring *__jsstr_concat_2(__jsstring *left, __jsstring *right) {
   uint32_t leftlen = __jsstr_get_length(left);
   uint32_t rightlen = __jsstr_get_length(right);
   uint32_t wholelen = leftlen + rightlen;
+  if (wholelen >= JSSTRING_ROPE_MIN_LENGTH && leftlen && rightlen) {
+    return __jsstr_new_rope(left, right);
+  }
   __jsstring *res;
   if (__jsstr_is_ascii(left) && __jsstr_is_ascii(right)) {
     res = __js_new_string_internal(wholelen, false);
@@ -300,6 +681,12 @@ __jsstring *__jsstr_concat_3(__jsstring *str1, __jsstring *str2, __jsstring *str
   uint32_t len2 = __jsstr_get_length(str2);
   uint32_t len3 = __jsstr_get_length(str3);
   uint32_t wholelen = len1 + len2 + len3;
+  if (wholelen >= JSSTRING_ROPE_MIN_LENGTH && len1 && len2 && len3) {
+    // The outer concatenation is a rope too, which keeps the inner one alive.
+    __jsstring *left = __jsstr_concat_2(str1, str2);
+    GCIncRf(left);
+    return __jsstr_new_rope_node(left, __jsstr_rope_operand(str3));
+  }
   __jsstring *res;
   if (__jsstr_is_ascii(str1) && __jsstr_is_ascii(str2) && __jsstr_is_ascii(str3)) {
     res = __js_new_string_internal(wholelen, false);
@@ -498,24 +885,8 @@ __jsvalue __jsstr_indexOf(__jsvalue *this_string, __jsvalue *search, __jsvalue *
   uint32_t len = __jsstr_get_length(s);
   // step 6:
   uint32_t start = (uint32_t)p < len ? p : len;
-  // step 7:
-  uint32_t slen = __jsstr_get_length(ss);
-  // step 8:
-  uint32_t k = start;
-  if (len >= slen) {
-    for (k = start; k <= len - slen; k++) {
-      uint32_t j = 0;
-      for (; j < slen; j++) {
-        if (__jsstr_get_char(s, k + j) != __jsstr_get_char(ss, j)) {
-          break;
-        }
-      }
-      if (j == slen) {
-        return __number_value(k);
-      }
-    }
-  }
-  return __number_value(-1);
+  // step 7, 8:
+  return __number_value((int32_t)__jsstr_find(s, ss, start));
 }
 
 // Ecma 15.5.4.8 String.prototype.lastIndexOf (searchString, position)
@@ -535,25 +906,9 @@ __jsvalue __jsstr_lastIndexOf(__jsvalue *this_string, __jsvalue *search, __jsval
   // step 7:
   p = p > 0 ? p : 0;
   uint32_t start = p < len ? p : len;
-  // step 8:
-  uint32_t slen = __jsstr_get_length(ss);
-  // step 9:
-  uint32_t k = start;
-  int32_t res = -1;
-  if (len >= slen) {
-    for (k = start; k <= len - slen; k++) {
-      uint32_t j = 0;
-      for (; j < slen; j++) {
-        if (__jsstr_get_char(s, k + j) != __jsstr_get_char(ss, j)) {
-          break;
-        }
-      }
-      if (j == slen) {
-        res = k;
-      }
-    }
-  }
-  return __number_value(res);
+  // step 8, 9: the last occurrence at or after start, which internal callers
+  // passing 0 rely on.
+  return __number_value((int32_t)__jsstr_find_last(s, ss, start));
 }
 
 // Ecma 15.5.4.9 String.prototype.localeCompare (that)
@@ -650,19 +1005,20 @@ bool __jsstr_splitMatch(__jsstring *s, uint32_t *q, __jsvalue *separator, uint32
     __jsobject *obj = __jsval_to_object(separator);
     if (obj->object_class == JSREGEXP) {
       // step 2:
-      std::wregex pattern;
-      bool global;
-      __jsstr_get_regexp_patten(pattern, separator, global);
-
       if (*q > __jsstr_get_length(s))
         return false;
-      std::wstring str = __jsstr_to_wstring(s, *q);
-
-      std::wsmatch sm;
-      std::regex_search (str, sm, pattern);
-      if (sm.size() > 0) {
-        *ret = *q + sm.position(0) + sm.length(0);
-        *q += sm.position(0);
+      __jsregexp_program *program = __jsregexp_get_exec_program(obj);
+      int res = dart::jscre::JSRegExpErrorNoMatch;
+      int offset_count = 0;
+      std::vector<int> offsets;
+      if (program) {
+        offset_count = (program->num_captures + 1) * 3;
+        offsets.resize(offset_count);
+        res = __jsregexp_execute(program, s, *q, offsets.data(), offset_count);
+      }
+      if (res > 0) {
+        *ret = offsets[1];
+        *q = offsets[0];
         return true;
       } else {
         *q = __jsstr_get_length(s) - 1;
@@ -739,6 +1095,7 @@ __jsvalue __jsstr_split(__jsvalue *this_string, __jsvalue *separator, __jsvalue
   if (sl == 0) {
     if (!__jsstr_splitMatch(s, &q, separator, &e))
       __jsobj_helper_add_value_property(a, __js_ToString(&nv), &v, JSPROP_DESC_HAS_VWEC);
+    __jsregexp_release_subject();
     return __object_value(a);
   }
   // step 12:
@@ -758,11 +1115,8 @@ __jsvalue __jsstr_split(__jsvalue *this_string, __jsvalue *separator, __jsvalue
         q++;
       else {
         // step 13.c.iii
-        t = __js_new_string_internal(q - p, true);
         // step 13.c.iii.1
-        for (uint32_t i = 0; i < q - p; i++) {
-          __jsstr_set_char(t, i, __jsstr_get_char(s, i + p));
-        }
+        t = __jsstr_extract(s, p, q - p);
         // step 13.c.iii.2
         __set_number(&nv, (int32_t)n);
         v = __string_value(t);
@@ -770,8 +1124,10 @@ __jsvalue __jsstr_split(__jsvalue *this_string, __jsvalue *separator, __jsvalue
         // step 13.c.iii.3
         __jsobj_helper_set_length(a, ++n, true);
         // step 13.c.iii.4
-        if (n == lim)
+        if (n == lim) {
+          __jsregexp_release_subject();
           return __object_value(a);
+        }
         // step 13.c.iii.5
         p = e;
         // step 13.c.iii.6
@@ -782,12 +1138,10 @@ __jsvalue __jsstr_split(__jsvalue *this_string, __jsvalue *separator, __jsvalue
       }
     }
   }
+  __jsregexp_release_subject();
   if (matched || p < sl) {
     // step 14:
-    t = __js_new_string_internal(q - p, true);
-    for (uint32_t i = 0; i < q - p; i++) {
-      __jsstr_set_char(t, i, __jsstr_get_char(s, i + p));
-    }
+    t = __jsstr_extract(s, p, q - p);
     __set_number(&nv, (int32_t)n);
     // step 15:
     v = __string_value(t);
@@ -990,88 +1344,43 @@ __jsvalue __jsstr_search(__jsvalue *this_string, __jsvalue *regexp) {
   return __number_value(ret);
 }
 
-static inline __jsvalue __jsstr_stdstr_to_value(std::wstring stdstr) {
-    int32_t len = stdstr.length();
-    if (len == 0)
-      return __string_value(__jsstr_get_builtin(JSBUILTIN_STRING_EMPTY));
-
-    __jsstring *str = __js_new_string_internal(len, true);
-    for (uint32_t i = 0; i < len; i++) {
-      __jsstr_set_char(str, i, (uint16_t)stdstr.at(i));
-    }
-    return __string_value(str);
-}
-
-// Memory allocation for jscre.
-static void* RegExpAlloc(size_t size) {
-  void *obj = VMMallocGC(size);
-  MAPLE_JS_ASSERT(obj);
-  return obj;
-}
-
-// Memory de-allocation for jscre.
-static void RegExpFree(void *ptr) {
-  // GC handles this.
-}
-
-static void __jsstr_get_regexp_property(__jsvalue *regexp, __jsstring *&js_pattern,
-                                        bool &global, bool &ignorecase, bool &multiline,
-                                        unsigned &num_captures) {
-
-  __jsvalue source = __jsop_getprop_by_name(regexp,
-                        __jsstr_get_builtin(JSBUILTIN_STRING_SOURCE));
-  js_pattern = __js_ToString(&source);
+// Scratch state of the String.prototype.match and replace loops: the program
+// and the subject stay the same for all the matches, and the capture offsets
+// of each match are written over the previous ones.
+struct __jsstr_match_state {
+  __jsregexp_program *program;
+  __jsstring *subject;
+  uint32_t num_captures;
+  std::vector<int> offsets;
+};
 
-  __jsvalue js_global = __jsop_getprop_by_name(regexp,
-                        __jsstr_get_builtin(JSBUILTIN_STRING_GLOBAL));
-  global = __js_ToBoolean(&js_global);
-
-  __jsvalue js_ignorecase = __jsop_getprop_by_name(regexp,
-                  __jsstr_get_builtin(JSBUILTIN_STRING_IGNORECASE_UL));
-  ignorecase = __js_ToBoolean(&js_ignorecase);
-
-  __jsvalue js_multiline = __jsop_getprop_by_name(regexp,
-                      __jsstr_get_builtin(JSBUILTIN_STRING_MULTILINE));
-  multiline = __js_ToBoolean(&js_multiline);
-}
-
-static int __jsstr_regexp_exec(__jsstring *js_subject, __jsstring *js_pattern,
-                                bool global, bool ignorecase, bool multiline,
-                                unsigned &num_captures, int &last_index,
-                                std::vector<std::pair<int,int>> *vres_ret) {
-  const char *error_message = NULL;
-  dart::jscre::JSRegExp * regexp = RegExpCompile(js_pattern, ignorecase,
-          multiline, &num_captures, &error_message, &RegExpAlloc, &RegExpFree);
-  if (regexp == NULL) {
-    if (strstr(error_message, "at end of pattern")) {
-      return -1;
-    } else {
-      MAPLE_JS_SYNTAXERROR_EXCEPTION();
-    }
+// Find the next match of STATE at or after FROM. On success offsets[2*i] and
+// offsets[2*i+1] bound capture i, or are -1 if it did not participate.
+static bool __jsstr_match_next(__jsstr_match_state *state, uint32_t from) {
+  if (from > __jsstr_get_length(state->subject)) {
+    return false;
   }
-
-  if (last_index >=  __jsstr_get_length(js_subject))
-    return 0;
-
-  int start_offset = global ? last_index : 0;
-  int *offsets = (int *) VMMallocGC((num_captures+1) * 3);
-  int offset_count = (num_captures+1) * 3;
-
-  int res = RegExpExecute(regexp, js_subject, start_offset, offsets,
-                          offset_count);
-
-  if (res == dart::jscre::JSRegExpErrorNoMatch ||
-      res == dart::jscre::JSRegExpErrorHitLimit) {
-    return -1;
+  int *offsets = state->offsets.data();
+  int res = __jsregexp_execute(state->program, state->subject, (int)from, offsets,
+                               (int)state->offsets.size());
+  if (res <= 0) {
+    return false;
   }
-
-  for (int i = 0; i < res; i++) {
-    vres_ret->push_back(std::make_pair(offsets[2 * i], offsets[2 * i + 1]));
-    if (i == 0)
-      last_index = offsets[2 * i + 1];
+  for (uint32_t i = 2 * res; i < 2 * (state->num_captures + 1); i++) {
+    offsets[i] = -1;
   }
+  return true;
+}
+
+// Position to search from after a match ending at END, which started at START.
+static inline uint32_t __jsstr_match_advance(int start, int end) {
+  return start == end ? end + 1 : end;
+}
 
-  return 1;
+static inline void __jsstr_reset_last_index(__jsvalue *regexp) {
+  __jsvalue zero = __number_value(0);
+  __jsobj_helper_add_value_property(__jsval_to_object(regexp), JSBUILTIN_STRING_LASTINDEX_UL,
+                                    &zero, JSPROP_DESC_HAS_VWUEUC);
 }
 
 // Ecma 15.5.4.10 String.prototype.match ( )
@@ -1108,164 +1417,135 @@ __jsvalue __jsstr_match(__jsvalue *this_string, __jsvalue *regexp) {
   if (!global)
     return __jsregexp_Exec(regexp, this_string, 1);
 
-  std::vector<std::pair<int,int>> vres_ret;
-  __jsstring *js_pattern = NULL;
-  bool ignorecase, multiline;
-  unsigned num_captures;
-  int last_index = 0;
-  __jsstr_get_regexp_property(regexp, js_pattern, global, ignorecase, multiline, num_captures);
-
-  int r;
-  do  {
-    r = __jsstr_regexp_exec(s, js_pattern, global, ignorecase, multiline, num_captures, last_index, &vres_ret);
-  } while (r == 1 && global);
-
-  if (r == -1 && vres_ret.size() == 0) {
-    __jsvalue items[1];
-    items[0] = __undefined_value();
-    __jsobject *array_obj = __js_new_arr_elems_direct(items, 1);
-    return __object_value(array_obj);
-  }
-  // workaround: vres_ret may contain duplicates due to dart::jscre issue, delete dup
-  std::sort(vres_ret.begin(), vres_ret.end());
-  vres_ret.erase(std::unique(vres_ret.begin(), vres_ret.end()), vres_ret.end());
-
-  int length = vres_ret.size();
-  __jsvalue items[length];
-  for (int i = 0; i < length; i++) {
-    int start = vres_ret[i].first, end = vres_ret[i].second;
-    if (start >= 0 && end - start >= 0) {
-      __jsvalue subject_val = __string_value(s);
-      __jsvalue start_val = __number_value(start);
-      __jsvalue end_val = __number_value(end);
-      __jsvalue str_val = __jsstr_substring(&subject_val, &start_val, &end_val);
-      items[i] = str_val;
-    } else {
-      items[i] = __undefined_value();
-    }
-  }
-
-  __jsobject *array_obj = __js_new_arr_elems_direct(items, length);
-
-  __jsvalue index = __number_value(vres_ret[0].first);
-  __jsobj_helper_add_value_property(array_obj, JSBUILTIN_STRING_INDEX, &index,
-                                    JSPROP_DESC_HAS_VWEC);
-
-  __jsvalue input = __string_value(s);
-  __jsobj_helper_add_value_property(array_obj, JSBUILTIN_STRING_INPUT, &input,
-                                    JSPROP_DESC_HAS_VWEC);
-
-  if (length > 0) {
-    __jsvalue js_last_index = __number_value(vres_ret[length - 1].second);
-    __jsobj_helper_add_value_property(array_obj, JSBUILTIN_STRING_LASTINDEX_UL,
-                                    &js_last_index, JSPROP_DESC_HAS_VWUEUC);
-  }
-
+  // step 8: collect the matched substrings without going through exec.
+  __jsstr_reset_last_index(regexp);
+  __jsstr_match_state state;
+  state.program = __jsregexp_get_exec_program(__jsval_to_object(regexp));
+  if (state.program == NULL) {
+    return __null_value();
+  }
+  state.subject = s;
+  state.num_captures = state.program->num_captures;
+  state.offsets.resize((state.num_captures + 1) * 3);
+
+  std::vector<__jsvalue> items;
+  uint32_t from = 0;
+  while (__jsstr_match_next(&state, from)) {
+    int start = state.offsets[0];
+    int end = state.offsets[1];
+    items.push_back(__string_value(__jsstr_extract(s, start, end - start)));
+    from = __jsstr_match_advance(start, end);
+  }
+  __jsregexp_release_subject();
+  if (items.empty()) {
+    return __null_value();
+  }
+  __jsobject *array_obj = __js_new_arr_elems_direct(items.data(), items.size());
   return __object_value(array_obj);
 }
 
-static inline void __jsstr_get_replace_value(__jsvalue *func, __jsvalue *this_string, std::vector<std::pair<int,int>> &vres_ret, __jsvalue &val) {
-  int j = 0;
-  __jsvalue match_start;
-  __jsvalue args[vres_ret.size() + 2];
-  for (int i = 0; i < vres_ret.size(); i++) {
-    int start = vres_ret[i].first;
-    int end = vres_ret[i].second;
-    if (i == 0) {
-      match_start = __number_value(start);
+// Append the result of calling FUNC on the match described by STATE, with the
+// arguments of Ecma 15.5.4.11 step 5.
+static void __jsstr_append_replace_value(__jsstr_builder *builder, __jsvalue *func,
+                                         __jsstr_match_state *state) {
+  __jsstring *s = state->subject;
+  const int *offsets = state->offsets.data();
+  uint32_t m = state->num_captures;
+  std::vector<__jsvalue> args(m + 3);
+  // Argument 1 is the substring that matched, the next m are the captures.
+  for (uint32_t i = 0; i <= m; i++) {
+    int start = offsets[2 * i];
+    int end = offsets[2 * i + 1];
+    if (start >= 0 && end >= start) {
+      args[i] = __string_value(__jsstr_extract(s, start, end - start));
+    } else {
+      args[i] = __undefined_value();
     }
-    // Argument 1 is the substring that matched
-    __jsvalue subject_val = *this_string;
-    __jsvalue start_val = __number_value(start);
-    __jsvalue end_val = __number_value(end);
-    __jsvalue str_val = __jsstr_substring(&subject_val, &start_val, &end_val);
-    args[j++] = str_val;
   }
   // Argument m + 2 is the offset within string where the match occurred
-  args[j++] = match_start;
+  args[m + 1] = __number_value(offsets[0]);
   // Argument m + 3 is string
-  args[j++] = *this_string;
+  args[m + 2] = __string_value(s);
 
   __jsobject *f = __jsval_to_object(func);
   __jsfunction *fun = f->shared.fun;
+  __jsvalue val;
   if (fun == NULL || fun->attrs == 0) {
     val = __undefined_value();
   } else {
-    __jsvalue undf;
+    __jsvalue this_value;
     if (fun->attrs & JSFUNCPROP_STRICT) {
-      undf = __undefined_value();
-      this_string = &undf;
+      this_value = __undefined_value();
     } else {
-      this_string = &__js_Global_ThisBinding;
+      this_value = __js_Global_ThisBinding;
     }
-    val = __jsfun_val_call(func, this_string, &args[0], j);
-  }
-}
-
-static inline bool __jsstr_get_replace_substitution(std::wstring &source, std::wstring &rep, std::vector<std::pair<int,int>> &vres_ret) {
-  bool has_substitution = false;
-  int start = vres_ret[0].first;
-  int end = vres_ret[vres_ret.size() - 1].second;
-  int i = 0;
-  while (i < rep.size()) {
-    if (rep[i] == L'$' && rep.size() - i >= 2) {
-      switch (rep[i + 1]) {
-        case L'$':
-          rep = rep.substr(0, i) + rep.substr(i + 1, rep.size() - i - 1);
-          i += 1;
-          has_substitution = true;
-          break;
-        case L'&':
-          // The matched substing
-          rep = rep.substr(0, i) +
-                source.substr(start, end - start) +
-                rep.substr(i + 2, rep.size() - i - 2);
-          i += end - start;
-          has_substitution = true;
-          break;
-        case L'`':
-          // The portion of string that precedes the matched substring
-          rep = rep.substr(0, i) +
-                source.substr(0, start) +
-                rep.substr(i + 2, rep.size() - i - 2);
-          i += start;
-          has_substitution = true;
-          break;
-        case L'\'':
-          // The portion of string that follows the matched substring
-          rep = rep.substr(0, i) +
-                source.substr(end, source.size() - end) +
-                rep.substr(i + 2, rep.size() - i - 2);
-          i += source.size() - end;
-          has_substitution = true;
-          break;
-        default:
-          if (rep[i + 1] > L'0' && rep[i + 1] <='9') {
-            // $n
-            int l = rep[i + 1] - L'0';
-            int offset = 2;
-            if (rep.size() - i >= 3 && rep[i + 2] >= L'0' && rep[i + 2] <='9' && vres_ret.size() > 9) {
-              // $nn
-              l = l * 10 + (rep[i + 2] - L'0');
-              offset = 3;
-            }
-            if (l <= vres_ret.size()) {
-              rep = rep.substr(0, i) +
-                    source.substr(vres_ret[l].first, vres_ret[l].second - vres_ret[l].first) +
-                    rep.substr(i + offset, rep.size() - i - offset);
-              i += vres_ret[l].second - vres_ret[l].first;
-            } else {
-              rep = rep.substr(0, i) + rep.substr(i + offset, rep.size() - i - offset);
-            }
-            has_substitution = true;
-          }
-          break;
+    val = __jsfun_val_call(func, &this_value, args.data(), m + 3);
+  }
+  __jsstr_builder_append(builder, __js_ToString(&val));
+}
+
+// Append REP with its $ patterns (Ecma 15.5.4.11 Table 22) expanded for the
+// match described by STATE. Patterns naming a capture that does not exist are
+// copied as they are.
+static void __jsstr_append_substitution(__jsstr_builder *builder, __jsstring *rep,
+                                        __jsstr_match_state *state) {
+  __jsstring *s = state->subject;
+  const int *offsets = state->offsets.data();
+  uint32_t m = state->num_captures;
+  uint32_t len = __jsstr_get_length(rep);
+  uint32_t run = 0;
+  uint32_t i = 0;
+  while (i + 1 < len) {
+    if (__jsstr_get_char(rep, i) != '$') {
+      i++;
+      continue;
+    }
+    uint16_t c = __jsstr_get_char(rep, i + 1);
+    uint32_t skip = 2;
+    int from = -1;
+    int to = -1;
+    if (c == '$') {
+      __jsstr_builder_append_range(builder, rep, run, i + 1 - run);
+      run = i + 2;
+      i += 2;
+      continue;
+    } else if (c == '&') {
+      from = offsets[0];
+      to = offsets[1];
+    } else if (c == '`') {
+      from = 0;
+      to = offsets[0];
+    } else if (c == '\'') {
+      from = offsets[1];
+      to = __jsstr_get_length(s);
+    } else if (c >= '0' && c <= '9') {
+      uint32_t n = c - '0';
+      if (i + 2 < len) {
+        uint16_t c2 = __jsstr_get_char(rep, i + 2);
+        uint32_t nn = n * 10 + (c2 - '0');
+        if (c2 >= '0' && c2 <= '9' && nn >= 1 && nn <= m) {
+          n = nn;
+          skip = 3;
+        }
       }
+      if (n < 1 || n > m) {
+        i++;
+        continue;
+      }
+      from = offsets[2 * n];
+      to = offsets[2 * n + 1];
     } else {
       i++;
+      continue;
+    }
+    __jsstr_builder_append_range(builder, rep, run, i - run);
+    if (from >= 0 && to > from) {
+      __jsstr_builder_append_range(builder, s, from, to - from);
     }
+    run = i + skip;
+    i += skip;
   }
-  return has_substitution;
+  __jsstr_builder_append_range(builder, rep, run, len - run);
 }
 
 // Ecma 15.5.4.11 String.prototype.replace ( )
@@ -1275,8 +1555,13 @@ __jsvalue __jsstr_replace(__jsvalue *this_string, __jsvalue *search, __jsvalue *
   // step 2:
   __jsstring *s = __js_ToString(this_string);
 
-  __jsstring *replace_str;
-  if (__is_js_object(replace)) {
+  bool functional = __js_IsCallable(replace);
+  __jsstring *replace_str = NULL;
+  if (functional) {
+    // Keep the subject alive, the replace function may drop the last
+    // reference to it.
+    GCIncRf(s);
+  } else if (__is_js_object(replace)) {
     __jsobject *obj = __jsval_to_object(replace);
     if (obj->object_class == JSSTRING) {
       replace_str = obj->shared.prim_string;
@@ -1293,64 +1578,79 @@ __jsvalue __jsstr_replace(__jsvalue *this_string, __jsvalue *search, __jsvalue *
   } else {
     replace_str = __js_ToString(replace);
   }
-
-  if (!__is_regexp(search)) {
-    __jsstring *pattern_str;
-    __jsvalue v;
-    if (__is_js_object(search)) {
-      __jsobject *obj = __jsval_to_object(search);
-      v = __object_internal_DefaultValue(obj, JSTYPE_STRING);
-      if (!__is_string(&v)) {
-        pattern_str = __js_ToString(&v);
-        v = __string_value(pattern_str);
-      }
-    } else {
-      pattern_str = __js_ToString(search);
-      v = __string_value(pattern_str);
+  bool has_dollar = false;
+  if (replace_str) {
+    uint32_t len = __jsstr_get_length(replace_str);
+    for (uint32_t i = 0; i < len && !has_dollar; i++) {
+      has_dollar = __jsstr_get_char(replace_str, i) == '$';
     }
-    __jsvalue val = __js_new_regexp_obj(NULL, &v, 1);
-    search = &val;
   }
 
-  std::vector<std::pair<int,int>> vres_ret;
-  __jsvalue match_start;
-  std::wstring result = __jsstr_to_wstring(s);
-  __jsstring *js_pattern = NULL;
-  bool ignorecase, multiline;
-  unsigned num_captures;
+  __jsstr_match_state state;
+  state.subject = s;
   bool global = false;
-  bool need_substitute = true;
-  int last_index = 0;
-  int distance = 0;
-  int r;
-  __jsstr_get_regexp_property(search, js_pattern, global, ignorecase, multiline, num_captures);
-  do  {
-    r = __jsstr_regexp_exec(s, js_pattern, global, ignorecase, multiline, num_captures, last_index, &vres_ret);
-    if (vres_ret.size() > 0) {
-      if (__js_IsCallable(replace)) {
-        __jsvalue val;
-        __jsstr_get_replace_value(replace, this_string, vres_ret, val);
-        replace_str = __js_ToString(&val);
-      }
+  __jsstring *search_str = NULL;
+  if (__is_regexp(search)) {
+    __jsvalue js_global = __jsop_getprop_by_name(search, __jsstr_get_builtin(JSBUILTIN_STRING_GLOBAL));
+    global = __js_ToBoolean(&js_global);
+    if (global) {
+      __jsstr_reset_last_index(search);
+    }
+    state.program = __jsregexp_get_exec_program(__jsval_to_object(search));
+    state.num_captures = state.program ? state.program->num_captures : 0;
+  } else {
+    // A string is searched for as it is, only its first occurrence is replaced.
+    search_str = __js_ToString(search);
+    state.program = NULL;
+    state.num_captures = 0;
+  }
+  state.offsets.resize((state.num_captures + 1) * 3);
 
-      std::wstring rep = __jsstr_to_wstring(replace_str);
-      std::wstring source = __jsstr_to_wstring(s);
-      if (need_substitute)
-        need_substitute = __jsstr_get_replace_substitution(source, rep, vres_ret);
-      result.replace(vres_ret[0].first + distance, vres_ret[0].second - vres_ret[0].first, rep);
-      distance += rep.size() - (vres_ret[0].second - vres_ret[0].first);
-      last_index = vres_ret[vres_ret.size() - 1].second + 1;
-
-      // when 'search' is an empty string, put 'rep' to the end as well
-      if (vres_ret[0].first == last_index - 1 && last_index >= __jsstr_get_length(s)) {
-        result.replace(last_index + distance, 0, rep);
+  __jsstr_builder builder;
+  uint32_t len = __jsstr_get_length(s);
+  bool matched = false;
+  uint32_t copied = 0;
+  uint32_t from = 0;
+  while (true) {
+    if (search_str) {
+      int64_t start = __jsstr_find(s, search_str, 0);
+      if (start < 0) {
+        break;
       }
-
-      vres_ret.clear();
+      state.offsets[0] = (int)start;
+      state.offsets[1] = (int)start + __jsstr_get_length(search_str);
+    } else if (!state.program || !__jsstr_match_next(&state, from)) {
+      break;
     }
-  } while (r == 1 && global && last_index <= __jsstr_get_length(s));
-
-  return __jsstr_stdstr_to_value(result);
+    matched = true;
+    int start = state.offsets[0];
+    int end = state.offsets[1];
+    __jsstr_builder_append_range(&builder, s, copied, start - copied);
+    if (functional) {
+      __jsstr_append_replace_value(&builder, replace, &state);
+    } else if (has_dollar) {
+      __jsstr_append_substitution(&builder, replace_str, &state);
+    } else {
+      __jsstr_builder_append(&builder, replace_str);
+    }
+    copied = end;
+    if (!global) {
+      break;
+    }
+    from = __jsstr_match_advance(start, end);
+  }
+  if (state.program) {
+    __jsregexp_release_subject();
+  }
+  __jsstring *result = s;
+  if (matched) {
+    __jsstr_builder_append_range(&builder, s, copied, len - copied);
+    result = __jsstr_builder_finish(&builder);
+  }
+  if (functional) {
+    GCDecRfNoRecall(s);
+  }
+  return __string_value(result);
 }
 
 uint32_t __jsstr_is_number(__jsstring *jsstr) {
@@ -1361,7 +1661,7 @@ uint32_t __jsstr_is_number(__jsstring *jsstr) {
   uint32_t i;
   assert((jsstr->kind & JSSTRING_UNICODE) == 0); // TODO: Unicode
   for (i = 0; i < length; i++) {
-    arr[i] = jsstr->x.ascii[i];
+    arr[i] = __jsstr_get_ascii(jsstr)[i];
   }
   arr[i] = '\0';
   char *end = nullptr;
@@ -1402,7 +1702,7 @@ uint32_t __jsstr_is_numidx(__jsstring *p, bool &isNumidx) {
     return 0;
   }
   char chars[len+1];
-  chars[0] = ((char *)p)[4];
+  chars[0] = (char)__jsstr_get_char(p, 0);
 
   // p is not a number or is negative
   if ((uint8_t)chars[0] > '9' || chars[0] == '-') {
@@ -1412,9 +1712,9 @@ uint32_t __jsstr_is_numidx(__jsstring *p, bool &isNumidx) {
   uint32_t i;
   for (i = 1; i < len; i++) {
     if (is_ascii)
-      chars[i] = ((char *)p)[4 + i];
+      chars[i] = __jsstr_get_ascii(p)[i];
     else
-      chars[i] = ((uint16_t *)p)[2 + i];
+      chars[i] = __jsstr_get_utf16(p)[i];
     if (i > 1 && (uint8_t)chars[i] > 'f') {
       return 0;
     }
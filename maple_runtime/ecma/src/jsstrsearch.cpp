@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) [2021] Futurewei Technologies, Inc. All rights reserved.
+ *
+ * OpenArkCompiler is licensed under the Mulan Permissive Software License v2.
+ * You can use this software according to the terms and conditions of the MulanPSL - 2.0.
+ * You may obtain a copy of MulanPSL - 2.0 at:
+ *
+ *   https://opensource.org/licenses/MulanPSL-2.0
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT, MERCHANTABILITY OR
+ * FIT FOR A PARTICULAR PURPOSE.
+ * See the MulanPSL - 2.0 for more details.
+ */
+
+#include <cstring>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "jsstrsearch.h"
+
+// A kernel looks for the NLEN (> 0) code units at NEEDLE at the candidate
+// positions FROM to TO of HAY, where TO + NLEN is at most the length of HAY.
+typedef int64_t (*__jsstr_search_kernel)(const void *hay, const void *needle, uint32_t nlen, uint32_t from,
+                                         uint32_t to);
+
+struct __jsstr_search_kernels {
+  __jsstr_search_kernel find8;
+  __jsstr_search_kernel find16;
+  __jsstr_search_kernel find_last8;
+  __jsstr_search_kernel find_last16;
+};
+
+template <typename T>
+static inline bool __jsstr_search_match(const T *hay, const T *needle, uint32_t nlen, uint32_t k) {
+  return memcmp(hay + k, needle, nlen * sizeof(T)) == 0;
+}
+
+template <typename T>
+static int64_t __jsstr_find_scalar(const void *h, const void *n, uint32_t nlen, uint32_t from, uint32_t to) {
+  const T *hay = (const T *)h;
+  const T *needle = (const T *)n;
+  for (uint32_t k = from; k <= to; k++) {
+    if (hay[k] == needle[0] && __jsstr_search_match(hay, needle, nlen, k)) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+template <typename T>
+static int64_t __jsstr_find_last_scalar(const void *h, const void *n, uint32_t nlen, uint32_t from, uint32_t to) {
+  const T *hay = (const T *)h;
+  const T *needle = (const T *)n;
+  for (int64_t k = to; k >= (int64_t)from; k--) {
+    if (hay[k] == needle[0] && __jsstr_search_match(hay, needle, nlen, (uint32_t)k)) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+#if defined(__x86_64__)
+// The masks below have one bit per byte, keep the bit of the first byte of
+// each code unit.
+#define JSSTR_SEARCH_LANE_BITS(T) (sizeof(T) == 1 ? 0xffffffffu : 0x55555555u)
+
+static inline __m128i __jsstr_splat_sse2(uint8_t c) {
+  return _mm_set1_epi8((char)c);
+}
+
+static inline __m128i __jsstr_splat_sse2(uint16_t c) {
+  return _mm_set1_epi16((short)c);
+}
+
+static inline __m128i __jsstr_cmpeq_sse2(__m128i a, __m128i b, uint8_t) {
+  return _mm_cmpeq_epi8(a, b);
+}
+
+static inline __m128i __jsstr_cmpeq_sse2(__m128i a, __m128i b, uint16_t) {
+  return _mm_cmpeq_epi16(a, b);
+}
+
+// Mask of the candidates K, K + 1, ... of the block at K whose first and last
+// code units are FIRST and LAST.
+template <typename T>
+static inline uint32_t __jsstr_candidates_sse2(const T *hay, uint32_t k, uint32_t nlen, __m128i first, __m128i last) {
+  __m128i block_first = _mm_loadu_si128((const __m128i *)(hay + k));
+  __m128i block_last = _mm_loadu_si128((const __m128i *)(hay + k + nlen - 1));
+  __m128i eq = _mm_and_si128(__jsstr_cmpeq_sse2(first, block_first, T()), __jsstr_cmpeq_sse2(last, block_last, T()));
+  return (uint32_t)_mm_movemask_epi8(eq) & JSSTR_SEARCH_LANE_BITS(T);
+}
+
+template <typename T>
+static int64_t __jsstr_find_sse2(const void *h, const void *n, uint32_t nlen, uint32_t from, uint32_t to) {
+  const T *hay = (const T *)h;
+  const T *needle = (const T *)n;
+  const uint32_t lanes = sizeof(__m128i) / sizeof(T);
+  __m128i first = __jsstr_splat_sse2(needle[0]);
+  __m128i last = __jsstr_splat_sse2(needle[nlen - 1]);
+  uint32_t k = from;
+  for (; (uint64_t)k + lanes - 1 <= to; k += lanes) {
+    uint32_t mask = __jsstr_candidates_sse2(hay, k, nlen, first, last);
+    while (mask) {
+      uint32_t i = k + __builtin_ctz(mask) / sizeof(T);
+      if (__jsstr_search_match(hay, needle, nlen, i)) {
+        return i;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return k <= to ? __jsstr_find_scalar<T>(h, n, nlen, k, to) : -1;
+}
+
+template <typename T>
+static int64_t __jsstr_find_last_sse2(const void *h, const void *n, uint32_t nlen, uint32_t from, uint32_t to) {
+  const T *hay = (const T *)h;
+  const T *needle = (const T *)n;
+  const uint32_t lanes = sizeof(__m128i) / sizeof(T);
+  __m128i first = __jsstr_splat_sse2(needle[0]);
+  __m128i last = __jsstr_splat_sse2(needle[nlen - 1]);
+  int64_t k = (int64_t)to - (lanes - 1);
+  for (; k >= (int64_t)from; k -= lanes) {
+    uint32_t mask = __jsstr_candidates_sse2(hay, (uint32_t)k, nlen, first, last);
+    while (mask) {
+      uint32_t bit = 31 - __builtin_clz(mask);
+      uint32_t i = (uint32_t)k + bit / sizeof(T);
+      if (__jsstr_search_match(hay, needle, nlen, i)) {
+        return i;
+      }
+      mask &= ~(1u << bit);
+    }
+  }
+  int64_t rest = k + lanes - 1;
+  return rest >= (int64_t)from ? __jsstr_find_last_scalar<T>(h, n, nlen, from, (uint32_t)rest) : -1;
+}
+
+// The AVX2 kernels are the SSE2 ones on 32-byte blocks, only called if the CPU
+// supports AVX2.
+#define JSSTR_AVX2 __attribute__((target("avx2")))
+
+JSSTR_AVX2 static inline __m256i __jsstr_splat_avx2(uint8_t c) {
+  return _mm256_set1_epi8((char)c);
+}
+
+JSSTR_AVX2 static inline __m256i __jsstr_splat_avx2(uint16_t c) {
+  return _mm256_set1_epi16((short)c);
+}
+
+JSSTR_AVX2 static inline __m256i __jsstr_cmpeq_avx2(__m256i a, __m256i b, uint8_t) {
+  return _mm256_cmpeq_epi8(a, b);
+}
+
+JSSTR_AVX2 static inline __m256i __jsstr_cmpeq_avx2(__m256i a, __m256i b, uint16_t) {
+  return _mm256_cmpeq_epi16(a, b);
+}
+
+template <typename T>
+JSSTR_AVX2 static inline uint32_t __jsstr_candidates_avx2(const T *hay, uint32_t k, uint32_t nlen, __m256i first,
+                                                          __m256i last) {
+  __m256i block_first = _mm256_loadu_si256((const __m256i *)(hay + k));
+  __m256i block_last = _mm256_loadu_si256((const __m256i *)(hay + k + nlen - 1));
+  __m256i eq = _mm256_and_si256(__jsstr_cmpeq_avx2(first, block_first, T()),
+                                __jsstr_cmpeq_avx2(last, block_last, T()));
+  return (uint32_t)_mm256_movemask_epi8(eq) & JSSTR_SEARCH_LANE_BITS(T);
+}
+
+template <typename T>
+JSSTR_AVX2 static int64_t __jsstr_find_avx2(const void *h, const void *n, uint32_t nlen, uint32_t from,
+                                            uint32_t to) {
+  const T *hay = (const T *)h;
+  const T *needle = (const T *)n;
+  const uint32_t lanes = sizeof(__m256i) / sizeof(T);
+  __m256i first = __jsstr_splat_avx2(needle[0]);
+  __m256i last = __jsstr_splat_avx2(needle[nlen - 1]);
+  uint32_t k = from;
+  for (; (uint64_t)k + lanes - 1 <= to; k += lanes) {
+    uint32_t mask = __jsstr_candidates_avx2(hay, k, nlen, first, last);
+    while (mask) {
+      uint32_t i = k + __builtin_ctz(mask) / sizeof(T);
+      if (__jsstr_search_match(hay, needle, nlen, i)) {
+        return i;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return k <= to ? __jsstr_find_sse2<T>(h, n, nlen, k, to) : -1;
+}
+
+template <typename T>
+JSSTR_AVX2 static int64_t __jsstr_find_last_avx2(const void *h, const void *n, uint32_t nlen, uint32_t from,
+                                                 uint32_t to) {
+  const T *hay = (const T *)h;
+  const T *needle = (const T *)n;
+  const uint32_t lanes = sizeof(__m256i) / sizeof(T);
+  __m256i first = __jsstr_splat_avx2(needle[0]);
+  __m256i last = __jsstr_splat_avx2(needle[nlen - 1]);
+  int64_t k = (int64_t)to - (lanes - 1);
+  for (; k >= (int64_t)from; k -= lanes) {
+    uint32_t mask = __jsstr_candidates_avx2(hay, (uint32_t)k, nlen, first, last);
+    while (mask) {
+      uint32_t bit = 31 - __builtin_clz(mask);
+      uint32_t i = (uint32_t)k + bit / sizeof(T);
+      if (__jsstr_search_match(hay, needle, nlen, i)) {
+        return i;
+      }
+      mask &= ~(1u << bit);
+    }
+  }
+  int64_t rest = k + lanes - 1;
+  return rest >= (int64_t)from ? __jsstr_find_last_sse2<T>(h, n, nlen, from, (uint32_t)rest) : -1;
+}
+#endif  // __x86_64__
+
+static __jsstr_search_kernels __jsstr_select_kernels() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    __jsstr_search_kernels kernels = {__jsstr_find_avx2<uint8_t>, __jsstr_find_avx2<uint16_t>,
+                                      __jsstr_find_last_avx2<uint8_t>, __jsstr_find_last_avx2<uint16_t>};
+    return kernels;
+  }
+  // SSE2 is part of x86-64.
+  __jsstr_search_kernels kernels = {__jsstr_find_sse2<uint8_t>, __jsstr_find_sse2<uint16_t>,
+                                    __jsstr_find_last_sse2<uint8_t>, __jsstr_find_last_sse2<uint16_t>};
+#else
+  __jsstr_search_kernels kernels = {__jsstr_find_scalar<uint8_t>, __jsstr_find_scalar<uint16_t>,
+                                    __jsstr_find_last_scalar<uint8_t>, __jsstr_find_last_scalar<uint16_t>};
+#endif
+  return kernels;
+}
+
+static int64_t __jsstr_search(__jsstring *haystack, __jsstring *needle, uint32_t from, bool find_last) {
+  static const __jsstr_search_kernels kernels = __jsstr_select_kernels();
+  uint32_t hlen = __jsstr_get_length(haystack);
+  uint32_t nlen = __jsstr_get_length(needle);
+  if (nlen > hlen || from > hlen - nlen) {
+    return -1;
+  }
+  uint32_t to = hlen - nlen;
+  if (nlen == 0) {
+    return find_last ? to : from;
+  }
+  if (__jsstr_is_ascii(haystack)) {
+    __jsstr_search_kernel kernel = find_last ? kernels.find_last8 : kernels.find8;
+    const char *hay = __jsstr_get_ascii(haystack);
+    if (__jsstr_is_ascii(needle)) {
+      return kernel(hay, __jsstr_get_ascii(needle), nlen, from, to);
+    }
+    // A unicode needle can only occur if all its code units fit in 8 bits.
+    const uint16_t *units = __jsstr_get_utf16(needle);
+    std::vector<uint8_t> narrow(nlen);
+    for (uint32_t i = 0; i < nlen; i++) {
+      if (units[i] > 0xff) {
+        return -1;
+      }
+      narrow[i] = (uint8_t)units[i];
+    }
+    return kernel(hay, narrow.data(), nlen, from, to);
+  }
+  __jsstr_search_kernel kernel = find_last ? kernels.find_last16 : kernels.find16;
+  const uint16_t *hay = __jsstr_get_utf16(haystack);
+  if (!__jsstr_is_ascii(needle)) {
+    return kernel(hay, __jsstr_get_utf16(needle), nlen, from, to);
+  }
+  const uint8_t *units = (const uint8_t *)__jsstr_get_ascii(needle);
+  std::vector<uint16_t> wide(units, units + nlen);
+  return kernel(hay, wide.data(), nlen, from, to);
+}
+
+int64_t __jsstr_find(__jsstring *haystack, __jsstring *needle, uint32_t from) {
+  return __jsstr_search(haystack, needle, from, false);
+}
+
+int64_t __jsstr_find_last(__jsstring *haystack, __jsstring *needle, uint32_t from) {
+  return __jsstr_search(haystack, needle, from, true);
+}
@@ -14,6 +14,12 @@
  */
 
 #include <string.h>
+#include <sys/mman.h>
+#include <iterator>
+#include <new>
+#include <vector>
+#include <thread>
+#include <chrono>
 #include "vmmemory.h"
 #include "jsobject.h"
 #include "jsobjectinline.h"
@@ -24,6 +30,7 @@
 #include "jsiter.h"
 #include "securec.h"
 #include "jsdataview.h"
+#include "jsregexp.h"
 #include <cmath>
 // This module performs memory management for both the app's heap space and the
 // VM's own dynamic memory space.  For memory blocks allocated in the app's
@@ -40,21 +47,27 @@
 // block.  When a block is being used, there does not need to be a MemoryChunk
 // to record it.  Its MemoryChunk is created only when the block is to be
 // recycled.  To recycle a block, its MemoryChunk is kept inside MemoryHash,
-// which groups them based on size. Thus, there are 2 MemoryHash instances, one
-// for the app's heap space (heap_memory_bank_) and one for the VM's own
-// dynamic memory space (vm_memory_bank_).
+// which groups them based on size; big blocks are merged with their free
+// neighbours when they are recycled and reused on a best fit basis.  Thus,
+// there are 2 MemoryHash instances, one for the app's heap space
+// (heap_memory_bank_) and one for the VM's own dynamic memory space
+// (vm_memory_bank_).
 //
 // MemoryChunk nodes are VM's own dynamic data structures, so their allocation
 // are in the VM's own dynamic memory space, and their re-uses are managed by
 // the VM.  The list of MemoryChunk nodes available for re-use is maintained
 // in free_memory_chunk_.
+//
+// Most blocks of the app's heap are small objects, properties and strings.
+// Those of up to SLAB_MAX_SIZE bytes do not go through MemoryHash: they are
+// carved from slabs, pages of the small heap dedicated to one size class, and
+// recycled through a free list kept inside each page.  A slab whose blocks
+// are all released goes to a pool of empty pages that any class can take
+// again, so the memory of a class is not lost to the others.
 using namespace maple;
 
 MemoryManager *memory_manager = NULL;
-#ifdef MARK_CYCLE_ROOTS
-CycleRoot *cycle_roots = NULL;
-CycleRoot *garbage_roots = NULL;
-#else
+#ifndef MARK_CYCLE_ROOTS
 __jsobject *obj_list = NULL;
 #endif
 bool is_sweep = false;
@@ -80,6 +93,12 @@ void *VMMallocGC(uint32 size, MemHeadTag tag, bool init_p) {
 #endif
   memheaderp->memheadtag = tag;
   memheaderp->refcount = 0;
+#ifdef MARK_CYCLE_ROOTS
+  memheaderp->is_root = false;
+  memheaderp->is_released = false;
+  memheaderp->cycle_color = CycleBlack;
+  memory_manager->cycle_alloc_bytes_ += alignedsize + head_size;
+#endif
   if (memory_manager->IsDebugGC()) {
     printf("memory %p was allocated with header %d size %d\n", ((void *)((uint8 *)memory + head_size)), tag, alignedsize);
   }
@@ -92,10 +111,10 @@ void *VMMallocGC(uint32 size, MemHeadTag tag, bool init_p) {
   return (void *)((uint8 *)memory + head_size);
 }
 
-void *VMReallocGC(void *origptr, uint32 origsize, uint32 newsize) {
+void *VMReallocGC(void *origptr, uint32 origsize, uint32 newsize, bool init_p) {
   uint32 alignedorigsize = memory_manager->Bytes4Align(origsize);
   uint32 alignednewsize = memory_manager->Bytes4Align(newsize);
-  void *memory = memory_manager->Realloc(origptr, alignedorigsize, alignednewsize);
+  void *memory = memory_manager->Realloc(origptr, alignedorigsize, alignednewsize, init_p);
 #ifdef MM_DEBUG
   int tag = memory_manager->GetMemHeader((uint8*)memory+MALLOCHEADSIZE).memheadtag;
   memory_manager->mem_alloc_bytes_by_tag[(int)tag] += alignednewsize + MALLOCHEADSIZE;
@@ -114,6 +133,9 @@ void MemoryHash::Debug() {
       printf("memory offset:%u, memory size:%u\n", node->offset_, node->size_);
     }
   }
+  for (auto &chunk : big_by_offset_) {
+    printf("memory offset:%u, memory size:%u\n", chunk.first, chunk.second.size_);
+  }
 }
 
 #endif
@@ -127,6 +149,13 @@ bool MemoryHash::CheckOffset(uint32 offset) {
       }
     }
   }
+  auto it = big_by_offset_.upper_bound(offset);
+  if (it != big_by_offset_.begin()) {
+    --it;
+    if (offset < it->first + it->second.size_) {
+      return false;
+    }
+  }
   return true;
 }
 
@@ -135,9 +164,9 @@ bool MemoryHash::CheckOffset(uint32 offset) {
 void MemoryHash::PutFreeChunk(MemoryChunk *mchunk) {
   uint32 index = mchunk->size_ >> 2;
   bool issmall = (index >= 1 && index < MEMHASHTABLESIZE);
-  uint32 x = issmall ? (--index) : (MEMHASHTABLESIZE - 1);
   // link the mchunk to the table
   if (issmall) {
+    uint32 x = index - 1;
 #ifdef MM_DEBUG
     MemoryChunk* c = table_[x];
     while(c) {
@@ -147,49 +176,36 @@ void MemoryHash::PutFreeChunk(MemoryChunk *mchunk) {
 #endif
     mchunk->next = table_[x];
     table_[x] = mchunk;
-  } else {  // find the poisition and put free chunk to it
-    MemoryChunk *node = table_[x];
-    MemoryChunk *prenode = NULL;
-    while (node && (node->offset_ < mchunk->offset_)) {
-      prenode = node;
-      node = node->next;
-    }
-    if (prenode) {
-      mchunk->next = node;
-      prenode->next = mchunk;
-    } else {
-      if (node) {
-        mchunk->next = node;
-        table_[x] = mchunk;
-      } else {
-        mchunk->next = NULL;
-        table_[x] = mchunk;
-      }
-    }
+  } else {
+    PutBigFreeChunk(mchunk->offset_, mchunk->size_, mchunk->zero_);
+    memory_manager->DeleteMemoryChunk(mchunk);
   }
 }
 
-void MemoryHash::MergeBigFreeChunk() {
-  // size must be >= MEMHASHTABLESIZE << 2
-  MemoryChunk *node = table_[MEMHASHTABLESIZE - 1];
-  if (!node) {
-    return;
-  }
-  MemoryChunk *nextnode = node->next;
-  while (nextnode) {  // merge the node
-    // MemoryChunk *nextnode = node->next;
-    if (node->offset_ + node->size_ == nextnode->offset_) {
-      // merge node and nextnode
-      node->size_ += nextnode->size_;
-      node->next = nextnode->next;
-      memory_manager->DeleteMemoryChunk(nextnode);
-    } else if (node->offset_ + node->size_ < nextnode->offset_) {
-      node = nextnode;
-    } else {
-      MIR_FATAL("something wrong with big free chunk node");
+// Add a big free chunk to the index, merged with the free chunks right before
+// and after it. The merged chunk is known zero if all its parts are.
+void MemoryHash::PutBigFreeChunk(uint32 offset, uint32 size, bool zero) {
+  auto next = big_by_offset_.lower_bound(offset);
+  MIR_ASSERT((next == big_by_offset_.end() || offset + size <= next->first) && "double free");
+  if (next != big_by_offset_.end() && offset + size == next->first) {
+    size += next->second.size_;
+    zero = zero && next->second.zero_;
+    big_by_size_.erase(std::make_pair(next->second.size_, next->first));
+    next = big_by_offset_.erase(next);
+  }
+  if (next != big_by_offset_.begin()) {
+    auto prev = std::prev(next);
+    MIR_ASSERT(prev->first + prev->second.size_ <= offset && "double free");
+    if (prev->first + prev->second.size_ == offset) {
+      offset = prev->first;
+      size += prev->second.size_;
+      zero = zero && prev->second.zero_;
+      big_by_size_.erase(std::make_pair(prev->second.size_, prev->first));
+      big_by_offset_.erase(prev);
     }
-    nextnode = node->next;
   }
+  big_by_offset_.emplace_hint(next, offset, BigFreeChunk{size, zero});
+  big_by_size_.insert(std::make_pair(size, offset));
 }
 
 MemoryChunk *MemoryHash::GetFreeChunk(uint32 size) {
@@ -202,34 +218,82 @@ MemoryChunk *MemoryHash::GetFreeChunk(uint32 size) {
       table_[index] = node->next;
     }
     return node;
-  } else {
-    MemoryChunk *node = table_[MEMHASHTABLESIZE - 1];
-    MemoryChunk *prenode = NULL;
-    while (node && node->size_ < size) {
-      prenode = node;
-      node = node->next;
-    }
-    if (!node) {
-      return NULL;
-    }
-    if (node->size_ == size) {
-      if (prenode) {
-        prenode->next = node->next;
-      } else {
-        table_[MEMHASHTABLESIZE - 1] = node->next;
+  }
+  // Best fit, the lowest offset among the smallest chunks that are big enough.
+  auto it = big_by_size_.lower_bound(std::make_pair(size, (uint32)0));
+  if (it == big_by_size_.end()) {
+    return NULL;
+  }
+  uint32 chunk_size = it->first;
+  uint32 offset = it->second;
+  big_by_size_.erase(it);
+  auto chunk = big_by_offset_.find(offset);
+  bool zero = chunk->second.zero_;
+  big_by_offset_.erase(chunk);
+  if (chunk_size > size) {
+    // The rest keeps its place, its neighbours are both in use.
+    big_by_offset_.emplace(offset + size, BigFreeChunk{chunk_size - size, zero});
+    big_by_size_.insert(std::make_pair(chunk_size - size, offset + size));
+  }
+  MemoryChunk *mchunk = memory_manager->NewMemoryChunk(offset, size, NULL);
+  mchunk->zero_ = zero;
+  return mchunk;
+}
+
+// Take the first SIZE bytes of the big free chunk starting at OFFSET, if there
+// is one that long. *ZERO tells whether they are known zero.
+bool MemoryHash::TakeBigChunkAt(uint32 offset, uint32 size, bool *zero) {
+  auto chunk = big_by_offset_.find(offset);
+  if (chunk == big_by_offset_.end() || chunk->second.size_ < size) {
+    return false;
+  }
+  uint32 chunk_size = chunk->second.size_;
+  *zero = chunk->second.zero_;
+  big_by_size_.erase(std::make_pair(chunk_size, offset));
+  big_by_offset_.erase(chunk);
+  if (chunk_size > size) {
+    big_by_offset_.emplace(offset + size, BigFreeChunk{chunk_size - size, *zero});
+    big_by_size_.insert(std::make_pair(chunk_size - size, offset + size));
+  }
+  return true;
+}
+
+// Get a big free chunk of SIZE bytes at an offset aligned on ALIGN, the bytes
+// around it stay free.
+MemoryChunk *MemoryHash::GetAlignedChunk(uint32 size, uint32 align) {
+  auto it = big_by_size_.lower_bound(std::make_pair(size, (uint32)0));
+  uint32 tries = 0;
+  while (it != big_by_size_.end()) {
+    uint32 chunk_size = it->first;
+    uint32 offset = it->second;
+    uint32 start = (offset + align - 1) & ~(align - 1);
+    if (start + size <= offset + chunk_size) {
+      big_by_size_.erase(it);
+      auto chunk = big_by_offset_.find(offset);
+      bool zero = chunk->second.zero_;
+      big_by_offset_.erase(chunk);
+      if (start > offset) {
+        MemoryChunk *head = memory_manager->NewMemoryChunk(offset, start - offset, NULL);
+        head->zero_ = zero;
+        PutFreeChunk(head);
       }
-    } else {
-      // node->size > size;
-      MemoryChunk *newnode = memory_manager->NewMemoryChunk(node->offset_ + size, node->size_ - size, node->next);
-      if (prenode) {
-        prenode->next = newnode;
-      } else {
-        table_[MEMHASHTABLESIZE - 1] = newnode;
+      if (start + size < offset + chunk_size) {
+        MemoryChunk *tail = memory_manager->NewMemoryChunk(start + size, offset + chunk_size - start - size, NULL);
+        tail->zero_ = zero;
+        PutFreeChunk(tail);
       }
-      node->size_ = size;
+      MemoryChunk *mchunk = memory_manager->NewMemoryChunk(start, size, NULL);
+      mchunk->zero_ = zero;
+      return mchunk;
+    }
+    // Any chunk of SIZE + ALIGN bytes will do, don't walk all the ones below.
+    if (++tries == 8) {
+      it = big_by_size_.lower_bound(std::make_pair(size + align, (uint32)0));
+    } else {
+      ++it;
     }
-    return node;
   }
+  return NULL;
 }
 
 #if MACHINE64
@@ -302,30 +366,27 @@ uint32_t MemoryManager::SetF64ToU32 (double f64) {
 
 // malloc memory in VM internal memory region, re-cycled via MemoryChunk nodes
 void *MemoryManager::MallocInternal(uint32 malloc_size) {
+  ReserveMemoryChunks();
   uint32 alignedsize = Bytes4Align(malloc_size);
   MemoryChunk *mchunk = vm_memory_bank_->GetFreeChunk(alignedsize);
   void *return_ptr = NULL;
   if (!mchunk) {
     if (vm_memory_bank_->IsBigSize(alignedsize)) {
       if (alignedsize + vm_free_big_offset_ > vm_memory_size_) {
-        // merge the big memory chunk
-        vm_memory_bank_->MergeBigFreeChunk();
-        mchunk = vm_memory_bank_->GetFreeChunk(malloc_size);
-        if (!mchunk) {
-          MIR_FATAL("run out of VM heap memory.\n");
-        }
-        return_ptr = (void *)((uint8 *)vm_memory_ + mchunk->offset_);
-        DeleteMemoryChunk(mchunk);
+        MAPLE_JS_RANGEERROR_EXCEPTION();
       } else {
         uint32 free_offset = vm_free_big_offset_;
+        uint8 *mem = (uint8 *)vm_memory_ + free_offset;
+        Commit(&vm_big_committed_, mem, mem + alignedsize);
         vm_free_big_offset_ += alignedsize;
-        return (void *)((uint8 *)vm_memory_ + free_offset);
+        return (void *)mem;
       }
     } else {
       if (alignedsize + vm_free_small_offset_ > vm_memory_small_size_) {
-        MIR_FATAL("TODO run out of VM internal small memory.\n");
+        MAPLE_JS_RANGEERROR_EXCEPTION();
       }
       return_ptr = (void *)((char *)vm_memory_ + vm_free_small_offset_);
+      Commit(&vm_small_committed_, return_ptr, (uint8 *)return_ptr + alignedsize);
       vm_free_small_offset_ += alignedsize;
     }
   } else {
@@ -480,9 +541,11 @@ void MemoryManager::AppMemLeakCheck() {
   //printf("Num of objects with MaxRC=0: released= %u live= %u total= %u\n", t_max_rc0_released, t_max_rc0_live, t_max_rc0_released + t_max_rc0_live);
   //printf("Num of alloc count excluding those with MaxRC=0: %u\n", ta_count - t_max_rc0_released - t_max_rc0_live);
 
+  DrainAllRecalls();
 #ifdef MARK_CYCLE_ROOTS
-  RecallCycle();
-  RecallRoots(cycle_roots);
+  while (!cycle_roots_.empty()) {
+    CollectCycles();
+  }
 #else
   MarkAndSweep();
 #endif
@@ -603,18 +666,71 @@ MemoryChunk *MemoryManager::NewMemoryChunk(uint32 offset, uint32 size, MemoryChu
     free_memory_chunk_ = new_chunk->next;
   } else {
     // new_chunk = (MemoryChunk *) MallocInternal(sizeof(MemoryChunk));
+    // Also reached when releasing memory, where nothing may throw.
+    uint32 alignedsize = Bytes4Align(sizeof(MemoryChunk));
     new_chunk = (MemoryChunk *)((uint8 *)vm_memory_ + vm_free_small_offset_);
-    vm_free_small_offset_ += Bytes4Align(sizeof(MemoryChunk));
-    if (vm_free_small_offset_ > vm_memory_small_size_) {
-      MIR_FATAL("TODO run out of VM internal memory.\n");
+    if (vm_free_small_offset_ + alignedsize > vm_memory_small_size_ ||
+        !TryCommit(&vm_small_committed_, new_chunk, (uint8 *)new_chunk + alignedsize)) {
+      MIR_FATAL("run out of VM memory for memory chunks");
     }
+    vm_free_small_offset_ += alignedsize;
   }
   new_chunk->offset_ = offset;
   new_chunk->size_ = size;
+  new_chunk->zero_ = false;
   new_chunk->next = next;
   return new_chunk;
 }
 
+void MemoryManager::ReserveMemoryChunks() {
+  if (free_memory_chunk_) {
+    return;
+  }
+  uint32 reserve = MEMCHUNK_RESERVE * Bytes4Align(sizeof(MemoryChunk));
+  if (vm_free_small_offset_ + reserve > vm_memory_small_size_) {
+    MAPLE_JS_RANGEERROR_EXCEPTION();
+  }
+  uint8 *mem = (uint8 *)vm_memory_ + vm_free_small_offset_;
+  Commit(&vm_small_committed_, mem, mem + reserve);
+}
+
+void *VMReserveMemory(uint32 size) {
+  void *memory = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    MIR_FATAL("cannot reserve the VM memory");
+  }
+  return memory;
+}
+
+// Make [FROM, TO) of the reserved range usable.  *COMMITTED is the end of what
+// the region has committed so far, commits are widened to HEAP_COMMIT_CHUNK
+// boundaries to keep the system calls rare.
+void MemoryManager::Commit(uint8 **committed, void *from, void *to) {
+  if (!TryCommit(committed, from, to)) {
+    MAPLE_JS_RANGEERROR_EXCEPTION();
+  }
+}
+
+bool MemoryManager::TryCommit(uint8 **committed, void *from, void *to) {
+  if ((uint8 *)to <= *committed) {
+    return true;
+  }
+  uintptr_t mask = ~(uintptr_t)(HEAP_COMMIT_CHUNK - 1);
+  uint8 *begin = (*committed && *committed >= from) ? *committed : (uint8 *)((uintptr_t)from & mask);
+  uint8 *end = (uint8 *)(((uintptr_t)to + HEAP_COMMIT_CHUNK - 1) & mask);
+  if (begin < reserved_begin_) {
+    begin = reserved_begin_;
+  }
+  if (end > reserved_end_) {
+    end = reserved_end_;
+  }
+  if (mprotect(begin, end - begin, PROT_READ | PROT_WRITE) != 0) {
+    return false;
+  }
+  *committed = end;
+  return true;
+}
+
 void MemoryManager::Init(void *app_memory, uint32 app_memory_size, void *vm_memory, uint32 vm_memory_size) {
   memory_ = app_memory;
   total_small_size_ = app_memory_size / 2;
@@ -632,6 +748,34 @@ void MemoryManager::Init(void *app_memory, uint32 app_memory_size, void *vm_memo
 
   heap_free_big_offset_ = total_small_size_;
   free_memory_chunk_ = NULL;
+  MIR_ASSERT(vm_memory == (uint8 *)app_memory + app_memory_size);
+  reserved_begin_ = (uint8 *)app_memory;
+  reserved_end_ = (uint8 *)vm_memory + vm_memory_size;
+  heap_small_committed_ = NULL;
+  heap_big_committed_ = NULL;
+  vm_small_committed_ = NULL;
+  vm_big_committed_ = NULL;
+  // The stack grows down from the end of the heap.
+  uint32 stack_size = app_memory_size / 4 < HEAP_STACK_SIZE ? Bytes4Align(app_memory_size / 4) : HEAP_STACK_SIZE;
+  heap_limit_ = app_memory_size - stack_size;
+  uint8 *stack_committed = NULL;
+  Commit(&stack_committed, (uint8 *)memory_ + heap_limit_, heap_end);
+  for (uint32 i = 0; i < SLAB_NUM_CLASSES; i++) {
+    slab_partial_[i] = NULL;
+  }
+  slab_pool_ = NULL;
+  slab_pool_size_ = 0;
+  recall_draining_ = false;
+  free_pending_.Init();
+  free_done_.Init();
+  free_outstanding_ = 0;
+  free_thread_started_ = false;
+#ifdef MARK_CYCLE_ROOTS
+  cycle_alloc_bytes_ = 0;
+  cycle_trigger_bytes_ = CYCLE_GROWTH_MIN;
+  cycle_work_ = 0;
+  cycle_budget_ = CYCLE_PAUSE_WORK;
+#endif
 #ifndef RC_NO_MMAP
   free_mmaps_ = NULL;
   free_mmap_nodes_ = NULL;
@@ -639,17 +783,20 @@ void MemoryManager::Init(void *app_memory, uint32 app_memory_size, void *vm_memo
   // avail_link_ = NewMemoryChunk(0, app_memory_size, NULL);
   heap_memory_bank_ = (MemoryHash *)((uint8 *)vm_memory_ + vm_free_small_offset_);
   uint32 alignedsize = Bytes4Align(sizeof(MemoryHash));
+  Commit(&vm_small_committed_, heap_memory_bank_, (uint8 *)heap_memory_bank_ + 2 * alignedsize);
   vm_free_small_offset_ += alignedsize;
   errno_t mem_ret1 = memset_s(heap_memory_bank_, alignedsize, 0, alignedsize);
   if (mem_ret1 != EOK) {
     MIR_FATAL("call memset_s firstly failed in MemoryManager::Init");
   }
+  new (heap_memory_bank_) MemoryHash();
   vm_memory_bank_ = (MemoryHash *)((uint8 *)vm_memory_ + vm_free_small_offset_);
   vm_free_small_offset_ += alignedsize;
   errno_t mem_ret2 = memset_s(vm_memory_bank_, alignedsize, 0, alignedsize);
   if (mem_ret2 != EOK) {
     MIR_FATAL("call memset_s secondly failed in MemoryManager::Init");
   }
+  new (vm_memory_bank_) MemoryHash();
 
 #ifdef MM_DEBUG
   app_mem_usage = 0;
@@ -691,41 +838,47 @@ void *MemoryManager::Malloc(uint32 size, bool init_p) {
 #if DEBUGGC
   assert((IsAlignedBy4(size)) && "memory doesn't align by 4 bytes");
 #endif
+  if (size <= SLAB_MAX_SIZE) {
+    return SlabMalloc(size, init_p);
+  }
+  ReserveMemoryChunks();
+  if (free_outstanding_ && heap_memory_bank_->IsBigSize(size)) {
+    ReclaimBackgroundFrees();
+  }
   mchunk = heap_memory_bank_->GetFreeChunk(size);
+  if (!mchunk && !recall_queue_.empty() && !recall_draining_) {
+    // The pending recalls may free a chunk that fits, try before growing the heap.
+    DrainRecallQueue(RECALL_PAUSE_WORK);
+    mchunk = heap_memory_bank_->GetFreeChunk(size);
+  }
   void *retmem = NULL;
   if (!mchunk) {
     uint32 heap_free_offset = 0;
-    if (heap_memory_bank_->IsBigSize(size)) {  // for big size we merge the free chunk to see if we can get a big memory
-      if (size + heap_free_big_offset_ > total_size_) {
-        // try to merge some free chunk;
-        heap_memory_bank_->MergeBigFreeChunk();
-        mchunk = heap_memory_bank_->GetFreeChunk(size);
-        if (!mchunk) {
-          MIR_FATAL("run out of VM heap memory.\n");
+    if (heap_memory_bank_->IsBigSize(size)) {
+      if (size + heap_free_big_offset_ > heap_limit_) {
+        if (DrainAllRecalls() || WaitBackgroundFrees()) {
+          return Malloc(size, init_p);
         }
+        MAPLE_JS_RANGEERROR_EXCEPTION();
       } else {
         heap_free_offset = heap_free_big_offset_;
+        uint8 *mem = (uint8 *)memory_ + heap_free_offset;
+        Commit(&heap_big_committed_, mem, mem + size);
         heap_free_big_offset_ += size;
-        return (void *)((uint8 *)memory_ + heap_free_offset);
+        return (void *)mem;
       }
     } else {
-      if (size + heap_free_small_offset_ > total_small_size_) {
-        // try to use big size heap space if it has not been used
-        if (heap_free_big_offset_ == total_small_size_ &&
-            heap_free_big_offset_ < total_size_ - (1024 * 1024)) {
-            total_small_size_ += 1024 * 1024;
-            heap_free_big_offset_ = total_small_size_;
-        } else {
-          MIR_FATAL("TODO run out of VM heap memory.\n");
-        }
+      if (size + heap_free_small_offset_ > total_small_size_ && (DrainAllRecalls() || WaitBackgroundFrees())) {
+        return Malloc(size, init_p);
       }
+      ReserveSmallHeap(heap_free_small_offset_, size);
       heap_free_offset = heap_free_small_offset_;
       heap_free_small_offset_ += size;
       return (void *)((uint8 *)memory_ + heap_free_offset);
     }
   }
   retmem = (void *)((uint8 *)memory_ + mchunk->offset_);
-  if (init_p) {
+  if (init_p && !mchunk->zero_) {
     errno_t ret = memset_s(retmem, size, 0, size);
     if (ret != EOK) {
       MIR_FATAL("call memset_s failed in MemoryManager::Malloc");
@@ -739,7 +892,149 @@ void *MemoryManager::Malloc(uint32 size, bool init_p) {
   return retmem;
 }
 
-void *MemoryManager::Realloc(void *origptr, uint32 origsize, uint32 newsize) {
+// Make sure SIZE bytes at OFFSET are in the small heap and committed.
+void MemoryManager::ReserveSmallHeap(uint32 offset, uint32 size) {
+  if (size + offset > total_small_size_) {
+    // try to use big size heap space if it has not been used
+    if (heap_free_big_offset_ == total_small_size_ &&
+        heap_free_big_offset_ + (1024 * 1024) < heap_limit_) {
+        total_small_size_ += 1024 * 1024;
+        heap_free_big_offset_ = total_small_size_;
+    } else {
+      MAPLE_JS_RANGEERROR_EXCEPTION();
+    }
+  }
+  uint8 *mem = (uint8 *)memory_ + offset;
+  Commit(&heap_small_committed_, mem, mem + size);
+}
+
+// Take an empty page from the pool, or carve a new one from the small heap.
+SlabPage *MemoryManager::SlabNewPage() {
+  ReserveMemoryChunks();
+  SlabPage *page = slab_pool_;
+  if (page) {
+    slab_pool_ = page->next_;
+    slab_pool_size_--;
+    page->fresh_ = false;
+    return page;
+  }
+  // Then the pages that went back to the free chunks.
+  MemoryChunk *mchunk = heap_memory_bank_->GetAlignedChunk(SLAB_PAGE_SIZE, SLAB_PAGE_SIZE);
+  if (mchunk) {
+    page = (SlabPage *)((uint8 *)memory_ + mchunk->offset_);
+    page->fresh_ = mchunk->zero_;
+    DeleteMemoryChunk(mchunk);
+    return page;
+  }
+  // Pages are aligned on SLAB_PAGE_SIZE so that a block finds its page from
+  // its offset, the bytes skipped to align go to the free chunks.
+  uint32 offset = (heap_free_small_offset_ + SLAB_PAGE_SIZE - 1) & ~(uint32)(SLAB_PAGE_SIZE - 1);
+  if (offset + SLAB_PAGE_SIZE > total_small_size_ && (DrainAllRecalls() || WaitBackgroundFrees())) {
+    return SlabNewPage();
+  }
+  ReserveSmallHeap(offset, SLAB_PAGE_SIZE);
+  if (offset > heap_free_small_offset_) {
+    MemoryChunk *mchunk = NewMemoryChunk(heap_free_small_offset_, offset - heap_free_small_offset_, NULL);
+    heap_memory_bank_->PutFreeChunk(mchunk);
+  }
+  heap_free_small_offset_ = offset + SLAB_PAGE_SIZE;
+  page = (SlabPage *)((uint8 *)memory_ + offset);
+  page->fresh_ = true;
+  return page;
+}
+
+static inline bool SlabIsFull(SlabPage *page, uint32 class_size) {
+  return page->free_ == 0 && page->bump_ + class_size > SLAB_PAGE_SIZE;
+}
+
+void *MemoryManager::SlabMalloc(uint32 size, bool init_p) {
+  uint32 index = SlabClassIndex(size);
+  uint32 class_size = SlabClassSize(index);
+  SlabPage *page = slab_partial_[index];
+  if (!page && !recall_queue_.empty() && !recall_draining_) {
+    DrainRecallQueue(RECALL_PAUSE_WORK);
+    page = slab_partial_[index];
+  }
+  if (!page) {
+    page = SlabNewPage();
+    page->next_ = NULL;
+    page->prev_ = NULL;
+    page->free_ = 0;
+    page->bump_ = SLAB_HEADER_SIZE;
+    page->live_ = 0;
+    page->class_ = index;
+    slab_partial_[index] = page;
+  }
+  uint8 *block;
+  bool dirty;
+  if (page->free_) {
+    block = (uint8 *)page + page->free_;
+    page->free_ = *(uint16 *)(block + MALLOCHEADSIZE);
+    dirty = true;
+  } else {
+    block = (uint8 *)page + page->bump_;
+    page->bump_ += class_size;
+    dirty = !page->fresh_;
+  }
+  page->live_++;
+  if (SlabIsFull(page, class_size)) {
+    // A full page leaves the list, SlabFree puts it back.
+    slab_partial_[index] = page->next_;
+    if (page->next_) {
+      page->next_->prev_ = NULL;
+    }
+  }
+  if (init_p && dirty) {
+    errno_t ret = memset_s(block, size, 0, size);
+    if (ret != EOK) {
+      MIR_FATAL("call memset_s failed in MemoryManager::SlabMalloc");
+    }
+  }
+  return block;
+}
+
+void MemoryManager::SlabFree(uint32 offset, uint32 size) {
+  uint32 page_offset = offset & ~(uint32)(SLAB_PAGE_SIZE - 1);
+  SlabPage *page = (SlabPage *)((uint8 *)memory_ + page_offset);
+  uint32 index = page->class_;
+  MIR_ASSERT(index == SlabClassIndex(size));
+  uint32 class_size = SlabClassSize(index);
+  bool was_full = SlabIsFull(page, class_size);
+  uint16 in_page = (uint16)(offset - page_offset);
+  *(uint16 *)((uint8 *)page + in_page + MALLOCHEADSIZE) = page->free_;
+  page->free_ = in_page;
+  page->live_--;
+  if (page->live_ == 0) {
+    if (!was_full) {
+      if (page->prev_) {
+        page->prev_->next_ = page->next_;
+      } else {
+        slab_partial_[index] = page->next_;
+      }
+      if (page->next_) {
+        page->next_->prev_ = page->prev_;
+      }
+    }
+    if (slab_pool_size_ < SLAB_POOL_MAX_PAGES) {
+      page->next_ = slab_pool_;
+      slab_pool_ = page;
+      slab_pool_size_++;
+    } else {
+      heap_memory_bank_->PutFreeChunk(NewMemoryChunk(page_offset, SLAB_PAGE_SIZE, NULL));
+    }
+    return;
+  }
+  if (was_full) {
+    page->prev_ = NULL;
+    page->next_ = slab_partial_[index];
+    if (page->next_) {
+      page->next_->prev_ = page;
+    }
+    slab_partial_[index] = page;
+  }
+}
+
+void *MemoryManager::Realloc(void *origptr, uint32 origsize, uint32 newsize, bool init_p) {
 #if DEBUGGC
   assert((IsAlignedBy4(origsize) && IsAlignedBy4(newsize)) && "memory doesn't align by 4 bytes");
 #endif
@@ -747,7 +1042,21 @@ void *MemoryManager::Realloc(void *origptr, uint32 origsize, uint32 newsize) {
 #ifdef MM_DEBUG
   num_Realloc_calls++;
 #endif
-  void *newptr = Malloc(newsize + MALLOCHEADSIZE);
+  uint32 offset = (uint32)((uint8 *)origptr - (uint8 *)memory_ - MALLOCHEADSIZE);
+  if (ResizeInPlace(offset, origsize + MALLOCHEADSIZE, newsize + MALLOCHEADSIZE, init_p)) {
+#ifdef MM_DEBUG
+    app_mem_usage += newsize - origsize;
+    if (app_mem_usage > max_app_mem_usage)
+      max_app_mem_usage = app_mem_usage;
+    mem_allocated += newsize + MALLOCHEADSIZE;
+    mem_released += origsize + MALLOCHEADSIZE;
+    mem_alloc_count++;
+    mem_release_count++;
+#endif
+    return (void *)((uint8 *)origptr - MALLOCHEADSIZE);
+  }
+  // The old contents are copied over, only the part added may need zeroing.
+  void *newptr = Malloc(newsize + MALLOCHEADSIZE, false);
   if (!newptr) {
     MIR_FATAL("out of memory");
   }
@@ -757,10 +1066,12 @@ void *MemoryManager::Realloc(void *origptr, uint32 origsize, uint32 newsize) {
     if (cpy_ret != EOK) {
       MIR_FATAL("call memcpy_s failed in MemoryManager::Realloc");
     }
-    errno_t set_ret =
-      memset_s((void *)((uint8 *)newptr + origsize + MALLOCHEADSIZE), newsize + MALLOCHEADSIZE, 0, newsize - origsize);
-    if (set_ret != EOK) {
-      MIR_FATAL("call memcpy_s failed in MemoryManager::Realloc");
+    if (init_p) {
+      errno_t set_ret =
+        memset_s((void *)((uint8 *)newptr + origsize + MALLOCHEADSIZE), newsize - origsize, 0, newsize - origsize);
+      if (set_ret != EOK) {
+        MIR_FATAL("call memcpy_s failed in MemoryManager::Realloc");
+      }
     }
   } else {
     errno_t cpy_ret =
@@ -773,6 +1084,70 @@ void *MemoryManager::Realloc(void *origptr, uint32 origsize, uint32 newsize) {
   return newptr;
 }
 
+// Resize the block of OLDSIZE bytes at OFFSET to NEWSIZE bytes without moving
+// it, return false if it has to move. A slab block stays in its size class, a
+// block of the heap shrinks by releasing its tail, and grows over the bump
+// pointer when it is the last block or over the free chunk right after it.
+bool MemoryManager::ResizeInPlace(uint32 offset, uint32 oldsize, uint32 newsize, bool init_p) {
+  uint8 *mem = (uint8 *)memory_ + offset;
+  if (oldsize <= SLAB_MAX_SIZE || newsize <= SLAB_MAX_SIZE) {
+    // Releasing a block finds its slab from its size.
+    if (oldsize > SLAB_MAX_SIZE || newsize > SLAB_MAX_SIZE || SlabClassIndex(oldsize) != SlabClassIndex(newsize)) {
+      return false;
+    }
+    if (init_p && newsize > oldsize) {
+      errno_t ret = memset_s(mem + oldsize, newsize - oldsize, 0, newsize - oldsize);
+      if (ret != EOK) {
+        MIR_FATAL("call memset_s failed in MemoryManager::ResizeInPlace");
+      }
+    }
+    return true;
+  }
+  if (newsize <= oldsize) {
+    uint32 tail = oldsize - newsize;
+    if (tail == 0) {
+      return true;
+    }
+    if (tail < FREE_BACKGROUND_MIN || !FreeInBackground(offset + newsize, tail)) {
+      // Indexed as a big chunk, even a short tail, to merge with its neighbours.
+      heap_memory_bank_->PutBigFreeChunk(offset + newsize, tail, false);
+    }
+    return true;
+  }
+  uint32 end = offset + oldsize;
+  uint32 grow = newsize - oldsize;
+  bool zero = false;
+  if (end == heap_free_big_offset_ && offset >= total_small_size_) {
+    if (newsize > heap_limit_ - offset) {
+      return false;
+    }
+    Commit(&heap_big_committed_, mem + oldsize, mem + newsize);
+    heap_free_big_offset_ += grow;
+    return true;
+  }
+  if (end == heap_free_small_offset_ && offset < total_small_size_) {
+    if (newsize > total_small_size_ - offset) {
+      return false;
+    }
+    Commit(&heap_small_committed_, mem + oldsize, mem + newsize);
+    heap_free_small_offset_ += grow;
+    return true;
+  }
+  if (free_outstanding_) {
+    ReclaimBackgroundFrees();
+  }
+  if (!heap_memory_bank_->TakeBigChunkAt(end, grow, &zero)) {
+    return false;
+  }
+  if (init_p && !zero) {
+    errno_t ret = memset_s(mem + oldsize, grow, 0, grow);
+    if (ret != EOK) {
+      MIR_FATAL("call memset_s failed in MemoryManager::ResizeInPlace");
+    }
+  }
+  return true;
+}
+
 // actuall we need to recall mem - MALLOCHEADSIZE with size+MALLOCHEADSIZE
 void MemoryManager::RecallMem(void *mem, uint32 size) {
   uint32 head_size = MALLOCHEADSIZE;
@@ -835,6 +1210,13 @@ void MemoryManager::RecallMem(void *mem, uint32 size) {
   live_objects.erase(mem);
 #endif  // MM_DEBUG
 
+  if (alignedsize + head_size <= SLAB_MAX_SIZE) {
+    SlabFree(offset, alignedsize + head_size);
+    return;
+  }
+  if (alignedsize + head_size >= FREE_BACKGROUND_MIN && FreeInBackground(offset, alignedsize + head_size)) {
+    return;
+  }
   MemoryChunk *mchunk = NewMemoryChunk(offset, alignedsize + head_size, NULL);
   // InsertMemoryChunk(mchunk);
   heap_memory_bank_->PutFreeChunk(mchunk);
@@ -854,7 +1236,18 @@ void MemoryManager::RecallString(__jsstring *str) {
     }
     MemHeader &header = memory_manager->GetMemHeader((void *)str);
     if (header.refcount == 0) {
+      if (__jsstr_is_rope(str)) {
+        RecallRope(str);
+        return;
+      }
+      if (str->kind & JSSTRING_ATOM) {
+        __jsstr_remove_atom(str);
+      }
+      __jsstring *parent = __jsstr_is_dependent(str) ? ((__jsstring_dep *)str)->parent : NULL;
       RecallMem((void *)str, __jsstr_get_bytesize(str));
+      if (parent) {
+        GCDecRf(parent);
+      }
     }
   }
   else {
@@ -866,11 +1259,44 @@ void MemoryManager::RecallString(__jsstring *str) {
         // RecallMem((void *)str, sizeof(__jsstring));
 }
 
+// Recall a rope and the strings only it referenced. Ropes nest as deep as
+// the loop of += that built them, so this doesn't recurse on them.
+void MemoryManager::RecallRope(__jsstring *str) {
+  std::vector<__jsstring *> ropes;
+  ropes.push_back(str);
+  while (!ropes.empty()) {
+    __jsstring_rope *rope = (__jsstring_rope *)ropes.back();
+    ropes.pop_back();
+    if (rope->gen.head.kind & JSSTRING_ATOM) {
+      __jsstr_remove_atom((__jsstring *)rope);
+    }
+    __jsstring *children[3] = {rope->left, rope->right, rope->flat};
+    for (uint32_t i = 0; i < 3; i++) {
+      __jsstring *child = children[i];
+      if (!child || !IsHeap((void *)child)) {
+        continue;
+      }
+      MemHeader &header = GetMemHeader((void *)child);
+      MIR_ASSERT(header.refcount > 0);
+      RcDec((void *)child, header);
+      if (header.refcount == 0) {
+        if (__jsstr_is_rope(child)) {
+          ropes.push_back(child);
+        } else {
+          RecallString(child);
+        }
+      }
+    }
+    RecallMem((void *)rope, sizeof(__jsstring_rope));
+  }
+}
+
 void MemoryManager::RecallArray_props(__jsvalue *array_props) {
   if (TurnoffGC())
     return;
-  uint32_t length = __jsval_to_uint32(&array_props[0]);
-  length = length > ARRAY_MAXINDEXNUM_INTERNAL ? ARRAY_MAXINDEXNUM_INTERNAL : length;
+  // Numeric elements hold no references.
+  uint32_t length = __jsarr_is_numeric(array_props) ? 0 :
+                    __jsarr_stored_length(array_props, __jsval_to_uint32(&array_props[0]));
   for (uint32_t i = 0; i < length + 1; i++) {
     if (__is_js_object(&array_props[i]) || __is_string(&array_props[i])) {
 // #ifndef RC_NO_MMAP
@@ -887,7 +1313,7 @@ void MemoryManager::RecallArray_props(__jsvalue *array_props) {
 #endif
     }
   }
-  RecallMem((void *)array_props, (length + 1) * sizeof(__jsvalue));
+  RecallMem((void *)(array_props - 1), __jsarr_block_size(__jsarr_capacity(array_props)));
 }
 
 void MemoryManager::RecallList(__json_list *list) {
@@ -903,6 +1329,135 @@ void MemoryManager::RecallList(__json_list *list) {
   RecallMem((void *)list, sizeof(__json_list));
 }
 
+void MemoryManager::RcOverflowInc(void *addr) {
+  MemHeader &header = GetMemHeader(addr);
+  if (header.refcount < UINT14_MAX) {
+    header.refcount = UINT14_MAX;
+    rc_overflow_[addr] = UINT14_MAX;
+  } else {
+    rc_overflow_[addr]++;
+  }
+}
+
+void MemoryManager::RcOverflowDec(void *addr) {
+  auto it = rc_overflow_.find(addr);
+  MIR_ASSERT(it != rc_overflow_.end());
+  if (--it->second == RC_OVERFLOW_RETURN) {
+    GetMemHeader(addr).refcount = RC_OVERFLOW_RETURN;
+    rc_overflow_.erase(it);
+  }
+}
+
+// Hand a released block to the free thread, starting it the first time.
+// Return false if the block must be released at once.
+bool MemoryManager::FreeInBackground(uint32 offset, uint32 size) {
+  if (!free_thread_started_) {
+    free_thread_started_ = true;
+    std::thread(&MemoryManager::FreeThreadLoop, this).detach();
+  }
+  if (!free_pending_.Push(offset, size)) {
+    return false;
+  }
+  free_outstanding_++;
+  {
+    // The free thread checks for work and goes to sleep holding the lock, so
+    // it cannot miss this one.
+    std::lock_guard<std::mutex> lock(free_mutex_);
+  }
+  free_cv_.notify_one();
+  return true;
+}
+
+// The free thread zeroes the blocks released to it, and hands them back.
+// Whole pages are given back to the system rather than written, they read as
+// zero the next time they are touched.
+void MemoryManager::FreeThreadLoop() {
+  for (;;) {
+    uint32 offset;
+    uint32 size;
+    if (!free_pending_.Pop(&offset, &size)) {
+      std::unique_lock<std::mutex> lock(free_mutex_);
+      free_cv_.wait(lock, [this] { return !free_pending_.Empty(); });
+      continue;
+    }
+    uint8 *begin = (uint8 *)memory_ + offset;
+    uint8 *end = begin + size;
+    uint8 *page_begin = (uint8 *)(((uintptr_t)begin + SLAB_PAGE_SIZE - 1) & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+    uint8 *page_end = (uint8 *)((uintptr_t)end & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+    if (page_end <= page_begin || madvise(page_begin, page_end - page_begin, MADV_DONTNEED) != 0) {
+      page_begin = page_end = end;
+    }
+    if (page_begin > begin && memset_s(begin, page_begin - begin, 0, page_begin - begin) != EOK) {
+      MIR_FATAL("call memset_s failed in MemoryManager::FreeThreadLoop");
+    }
+    if (end > page_end && memset_s(page_end, end - page_end, 0, end - page_end) != EOK) {
+      MIR_FATAL("call memset_s failed in MemoryManager::FreeThreadLoop");
+    }
+    while (!free_done_.Push(offset, size)) {
+      // The allocator takes them back at safepoints and when it needs memory.
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+// Put the blocks the free thread is done with back to the free chunks.
+void MemoryManager::ReclaimBackgroundFrees() {
+  uint32 offset;
+  uint32 size;
+  while (free_done_.Pop(&offset, &size)) {
+    MemoryChunk *mchunk = NewMemoryChunk(offset, size, NULL);
+    mchunk->zero_ = true;
+    heap_memory_bank_->PutFreeChunk(mchunk);
+    free_outstanding_--;
+  }
+}
+
+// Wait for all the blocks given to the free thread before the heap runs out,
+// return whether there were any.
+bool MemoryManager::WaitBackgroundFrees() {
+  if (!free_outstanding_) {
+    return false;
+  }
+  while (free_outstanding_) {
+    ReclaimBackgroundFrees();
+    if (free_outstanding_) {
+      std::this_thread::yield();
+    }
+  }
+  return true;
+}
+
+// Recall queued objects, up to BUDGET of them. Those whose count drops to 0
+// meanwhile join the queue, the one draining it recalls them.
+void MemoryManager::DrainRecallQueue(uint32 budget) {
+  if (recall_draining_) {
+    return;
+  }
+  recall_draining_ = true;
+  try {
+    while (budget && !recall_queue_.empty()) {
+      __jsobject *obj = recall_queue_.back();
+      recall_queue_.pop_back();
+      ManageObject(obj, RECALL);
+      budget--;
+    }
+  } catch (...) {
+    recall_draining_ = false;
+    throw;
+  }
+  recall_draining_ = false;
+}
+
+// Recall all the queued objects before the heap runs out, return whether
+// there were any.
+bool MemoryManager::DrainAllRecalls() {
+  if (recall_queue_.empty() || recall_draining_) {
+    return false;
+  }
+  DrainRecallQueue(UINT32_MAX);
+  return true;
+}
+
 // decrease the memory, recall it if necessary
 void MemoryManager::GCDecRf(void *addr) {
   if (TurnoffGC())
@@ -916,15 +1471,21 @@ void MemoryManager::GCDecRf(void *addr) {
 #endif
   MemHeader &header = GetMemHeader(true_addr);
   MIR_ASSERT(header.refcount > 0);  // must > 0
-  if(header.refcount < UINT14_MAX)
-    header.refcount--;
+  RcDec(true_addr, header);
   // DEBUG
   // printf("address: 0x%x   rf - to: %d\n", true_addr, header.refcount);
   if (header.refcount == 0) {
     switch (header.memheadtag) {
       case MemHeadJSObj: {
-        __jsobject *obj = (__jsobject *)true_addr;
-        ManageObject(obj, RECALL);
+        // Recalling an object drops the references it holds, which can free a
+        // whole structure: queue it rather than recursing, and leave what the
+        // prompt budget doesn't cover to the next safepoint.
+        try {
+          recall_queue_.push_back((__jsobject *)true_addr);
+        } catch (std::bad_alloc &) {
+          MIR_FATAL("run out of memory for the recall queue");
+        }
+        DrainRecallQueue(RECALL_PROMPT_WORK);
         return;
       }
       case MemHeadJSString: {
@@ -945,6 +1506,12 @@ void MemoryManager::GCDecRf(void *addr) {
         MIR_FATAL("unknown GC object type");
     }
   }
+#ifdef MARK_CYCLE_ROOTS
+  // The reference dropped may have been the last one from outside a cycle.
+  if (header.memheadtag == MemHeadJSObj && !header.is_root) {
+    AddCycleRoot((__jsobject *)true_addr);
+  }
+#endif
 }
 
 // #ifndef RC_NO_MMAP
@@ -1101,49 +1668,84 @@ void MemoryManager::UpdateAddrMap(uint32_t *origptr, uint32_t *newptr, uint32_t
 #endif
 
 #ifdef MARK_CYCLE_ROOTS
-void MemoryManager::AddCycleRootNode(CycleRoot **roots_head, __jsobject *obj) {
-  CycleRoot *root = (CycleRoot *)VMMallocGC(sizeof(CycleRoot));
-  root->obj = obj;
-  root->next = *roots_head;
-  if (*roots_head) {
-    (*roots_head)->pre = root;
+/* Garbage cycles are found by trial deletion (Bacon and Rajan, "Concurrent Cycle
+   Collection in Reference Counted Systems", the synchronous variant).  An object
+   whose reference count is decreased without reaching 0 is buffered in
+   cycle_roots_ as a candidate root.  A collection then
+   1.paints gray everything reachable from the candidates, decreasing the reference
+     count of each object for every reference from a gray object (DECREASE);
+   2.paints white the gray objects left without references, and black again the
+     ones still referenced from elsewhere, restoring the counts of all the objects
+     reachable from those (SCAN and RESTORE);
+   3.releases the white objects, only referenced from each other (COLLECT and SWEEP).
+   The phases walk the objects with cycle_stack_ rather than recursing. An
+   object is painted gray when its references are visited, so the ones painted
+   are the ones whose references were decreased, and a marking over the
+   budget of the pause can be given up (UNMARK).
+   Environments are walked like objects, so that a closure and the environment
+   it captures are collected together. They are kept on the same stacks as
+   __jsobject pointers and told apart by their tag (ManageCycleNode). */
+void MemoryManager::AddCycleRoot(__jsobject *obj) {
+  // Reached when releasing a reference: without room for the candidate, a
+  // cycle through OBJ is only left uncollected.
+  try {
+    cycle_roots_.push_back(obj);
+  } catch (std::bad_alloc &) {
+    return;
   }
-  *roots_head = root;
-  (*roots_head)->pre = NULL;
+  GetMemHeader(obj).is_root = true;
 }
 
-void MemoryManager::DeleteCycleRootNode(CycleRoot *root) {
-  if (root->pre) {
-    root->pre->next = root->next;
-  } else {
-    cycle_roots = root->next;
+// An environment referenced from an object or from another environment.
+void MemoryManager::ManageChildEnv(void *envptr, ManageType flag) {
+  if (!envptr || !IsHeap(envptr) || GetMemHeader(envptr).memheadtag != MemHeadEnv) {
+    return;
   }
-  if (root->next) {
-    root->next->pre = root->pre;
+  ManageChildObj((__jsobject *)envptr, flag);
+}
+
+void MemoryManager::ManageCycleNode(__jsobject *node, ManageType flag) {
+  if (GetMemHeader(node).memheadtag == MemHeadEnv) {
+    ManageEnvironment(node, flag);
+  } else {
+    ManageObject(node, flag);
   }
-  RecallMem(root, sizeof(CycleRoot));
 }
 
 void MemoryManager::ManageChildObj(__jsobject *obj, ManageType flag) {
   if (!obj) {
     return;
   }
+  MemHeader &header = GetMemHeader(obj);
   if (flag == DECREASE) {
-    if (!(--GetMemHeader(obj).refcount)) {
-      if (GetMemHeader(obj).is_root && GetMemHeader(obj).is_decreased) {
-        return;
-      }
-      ManageObject(obj, flag);
+    if (header.refcount > 0) {
+      RcDec(obj, header);
+    } else {
+      cycle_skipped_[obj]++;
+    }
+    if (header.cycle_color != CycleGray) {
+      cycle_stack_.push_back(obj);
+    }
+  } else if (flag == RESTORE || flag == UNMARK) {
+    auto it = cycle_skipped_.find(obj);
+    if (it == cycle_skipped_.end()) {
+      RcInc(obj, header);
+    } else if (--it->second == 0) {
+      cycle_skipped_.erase(it);
     }
-  } else if (flag == RESTORE) {
-    if (++GetMemHeader(obj).refcount == 1) {
-      ManageObject(obj, flag);
+    if (flag == RESTORE && header.cycle_color != CycleBlack) {
+      header.cycle_color = CycleBlack;
+      cycle_stack_.push_back(obj);
+    }
+  } else if (flag == SCAN) {
+    if (header.cycle_color == CycleGray) {
+      cycle_stack_.push_back(obj);
     }
   } else if (flag == COLLECT) {
-    if ((!GetMemHeader(obj).refcount) && (!GetMemHeader(obj).is_collected)) {
-      AddCycleRootNode(&garbage_roots, obj);
-      GetMemHeader(obj).is_collected = true;
-      ManageObject(obj, flag);
+    if (header.cycle_color == CycleWhite) {
+      header.cycle_color = CycleGarbage;
+      cycle_garbage_.push_back(obj);
+      cycle_stack_.push_back(obj);
     }
   } else if (flag == RECALL) {
     GCDecRf(obj);
@@ -1180,30 +1782,33 @@ void MemoryManager::ManageEnvironment(void *envptr, ManageType flag) {
     return;
   }
 #ifdef MACHINE64
-  //assert(false && "NYI");
-  return;
+  // Every field is a 64-bit word: the number of variables, the parent
+  // environment, then the variables as encoded values.
+  uint64 *words = (uint64 *)envptr;
+  uint32 argnums = (uint32)words[0];
+  void *parentenv = (void *)(words[1] & PAYLOAD_MASK);
+  uint32 totalsize = (argnums + 2) * sizeof(uint64);
 #else
   uint32 *u32envptr = (uint32 *)envptr;
   Mval *mvalptr = (Mval *)envptr;
   void *parentenv = (void *)u32envptr[1];
-  if (parentenv) {
-    if (flag != RECALL) {
-      ManageEnvironment(parentenv, flag);
-    } else {
-      GCDecRf(parentenv);
-    }
-  }
   uint32 argnums = u32envptr[0];
-  uint32 totalsize = sizeof(uint32) + sizeof(void *);  // basic size
+  uint32 totalsize = sizeof(uint32) + sizeof(void *) + argnums * sizeof(Mval);
+#endif
+  ManageChildEnv(parentenv, flag);
   for (uint32 i = 1; i <= argnums; i++) {
+#ifdef MACHINE64
+    __jsvalue val;
+    val.x.u64 = words[i + 1];
+    mDecode(val);
+#else
     __jsvalue val = MvalToJsval(mvalptr[i]);
+#endif
     ManageJsvalue(&val, flag);
-    totalsize += sizeof(Mval);
   }
-  if (flag == RECALL) {
+  if (flag == SWEEP || flag == RECALL) {
     RecallMem(envptr, totalsize);
   }
-#endif
 }
 
 void MemoryManager::ManageProp(__jsprop *prop, ManageType flag) {
@@ -1233,6 +1838,16 @@ void MemoryManager::ManageObject(__jsobject *obj, ManageType flag) {
     ManageProp(jsprop, flag);
     jsprop = next_jsprop;
   }
+  if (obj->shape) {
+    uint32_t count = obj->shape->slot_count;
+    for (uint32_t i = 0; i < count; i++) {
+      __jsvalue jsvalue = obj->slots[i];
+      ManageJsvalue(&jsvalue, flag);
+    }
+    if (obj->slots && (flag == SWEEP || flag == RECALL)) {
+      RecallMem((void *)obj->slots, __jsshape_slot_capacity(count) * sizeof(__jsvalue));
+    }
+  }
 
   if (!obj->proto_is_builtin) {
     ManageChildObj(obj->prototype.obj, flag);
@@ -1247,14 +1862,14 @@ void MemoryManager::ManageObject(__jsobject *obj, ManageType flag) {
     case JSARRAY:
       if (obj->object_type == JSREGULAR_ARRAY) {
         __jsvalue *array = obj->shared.array_props;
-        uint32 arrlen = (uint32_t)__jsval_to_number(&array[0]);
+        uint32 arrlen = __jsarr_is_numeric(array) ? 0 :
+                        __jsarr_stored_length(array, (uint32_t)__jsval_to_number(&array[0]));
         for (uint32_t i = 0; i < arrlen; i++) {
           __jsvalue jsvalue = obj->shared.array_props[i + 1];
           ManageJsvalue(&jsvalue, flag);
         }
         if (flag == SWEEP || flag == RECALL) {
-          uint32_t size = (arrlen + 1) * sizeof(__jsvalue);
-          RecallMem((void *)obj->shared.array_props, size);
+          RecallMem((void *)(array - 1), __jsarr_block_size(__jsarr_capacity(array)));
         }
       }
       break;
@@ -1275,23 +1890,27 @@ void MemoryManager::ManageObject(__jsobject *obj, ManageType flag) {
             if (fun->env != nullptr)
               RecallMem(fun->env, bound_argc * sizeof(__jsvalue));
           }
+        } else if (flag == RECALL) {
+          GCDecRf(fun->env);
         } else {
-          if ((flag != SWEEP) && (flag != RECALL)) {
-            ManageEnvironment(fun->env, flag);
-          } else {
-            GCDecRf(fun->env);
-          }
+          ManageChildEnv(fun->env, flag);
         }
         if (flag == SWEEP || flag == RECALL) {
           RecallMem(fun, sizeof(__jsfunction));
         }
       }
       break;
-    case JSARRAYBUFFER: {
-      __jsarraybyte *arrayByte = obj->shared.arrayByte;
-      RecallMem((void *)arrayByte, sizeof(uint8_t) * __jsval_to_number(&arrayByte->length));
-    }
-    break;
+    case JSARRAYBUFFER:
+      if (flag == SWEEP || flag == RECALL) {
+        __jsarraybyte *arrayByte = obj->shared.arrayByte;
+        RecallMem((void *)arrayByte, sizeof(uint8_t) * __jsval_to_number(&arrayByte->length));
+      }
+      break;
+    case JSREGEXP:
+      if ((flag == SWEEP || flag == RECALL) && obj->shared.regexp) {
+        __jsregexp_release_program(obj->shared.regexp);
+      }
+      break;
     case JSDATAVIEW:
     case JSOBJECT:
     case JSBOOLEAN:
@@ -1300,7 +1919,6 @@ void MemoryManager::ManageObject(__jsobject *obj, ManageType flag) {
     case JSON:
     case JSMATH:
     case JSDOUBLE:
-    case JSREGEXP:
     case JSDATE:
     case JSINTL_COLLATOR:
     case JSINTL_NUMBERFORMAT:
@@ -1312,103 +1930,168 @@ void MemoryManager::ManageObject(__jsobject *obj, ManageType flag) {
       MIR_FATAL("manage unknown js object class");
   }
   if (flag == SWEEP || flag == RECALL) {
+    __jsobj_invalidate_layout(obj);
     if (obj->prop_index_map)
       delete(obj->prop_index_map);
     if (obj->prop_string_map)
-      delete(obj->prop_string_map);
+      __jsprop_dict_free(obj->prop_string_map);
+    if (GetMemHeader(obj).is_root) {
+      // Still buffered, CollectCycles frees it when it gets there.
+      GetMemHeader(obj).is_released = true;
+      return;
+    }
     RecallMem((void *)obj, sizeof(__jsobject));
   }
 }
 
-void MemoryManager::RecallRoots(CycleRoot *root) {
-  if (TurnoffGC())
-    return;
-  if (!root) {
-    return;
+// Returns false, with the marking undone, if it would go over the budget.
+bool MemoryManager::CycleMarkGray(__jsobject *obj) {
+  cycle_marked_.clear();
+  cycle_stack_.push_back(obj);
+  while (!cycle_stack_.empty()) {
+    __jsobject *cur = cycle_stack_.back();
+    cycle_stack_.pop_back();
+    MemHeader &header = GetMemHeader(cur);
+    if (header.cycle_color == CycleGray) {
+      continue;
+    }
+    if (cycle_work_ >= cycle_budget_) {
+      cycle_stack_.clear();
+      CycleUnmark();
+      return false;
+    }
+    header.cycle_color = CycleGray;
+    cycle_marked_.push_back(cur);
+    cycle_work_++;
+    ManageCycleNode(cur, DECREASE);
+  }
+  return true;
+}
+
+// Give back the counts the marking from the current candidate decreased. The
+// objects marked from the earlier candidates of the pause stay gray.
+void MemoryManager::CycleUnmark() {
+  for (size_t i = 0; i < cycle_marked_.size(); i++) {
+    __jsobject *obj = cycle_marked_[i];
+    GetMemHeader(obj).cycle_color = CycleBlack;
+    ManageCycleNode(obj, UNMARK);
+  }
+  cycle_marked_.clear();
+}
+
+void MemoryManager::CycleScanBlack(__jsobject *obj) {
+  // Runs in the middle of CycleScan, leave its part of the stack alone.
+  size_t base = cycle_stack_.size();
+  GetMemHeader(obj).cycle_color = CycleBlack;
+  cycle_stack_.push_back(obj);
+  while (cycle_stack_.size() > base) {
+    __jsobject *cur = cycle_stack_.back();
+    cycle_stack_.pop_back();
+    ManageCycleNode(cur, RESTORE);
   }
-  while (root) {
-    CycleRoot *cur_root = root;
-    root = root->next;
-    RecallMem(cur_root, sizeof(CycleRoot));
+}
+
+void MemoryManager::CycleScan(__jsobject *obj) {
+  cycle_stack_.push_back(obj);
+  while (!cycle_stack_.empty()) {
+    __jsobject *cur = cycle_stack_.back();
+    cycle_stack_.pop_back();
+    MemHeader &header = GetMemHeader(cur);
+    if (header.cycle_color != CycleGray) {
+      continue;
+    }
+    if (header.refcount > 0) {
+      CycleScanBlack(cur);
+    } else {
+      header.cycle_color = CycleWhite;
+      ManageCycleNode(cur, SCAN);
+    }
   }
 }
 
-void MemoryManager::ResetCycleRoots() {
-  if (!cycle_roots) {
+void MemoryManager::CycleCollectWhite(__jsobject *obj) {
+  MemHeader &header = GetMemHeader(obj);
+  if (header.cycle_color != CycleWhite) {
     return;
   }
-  CycleRoot *root = cycle_roots;
-  while (root) {
-    GetMemHeader(root->obj).is_decreased = false;
-    GetMemHeader(root->obj).need_restore = false;
-    GetMemHeader(root->obj).is_collected = false;
-    root = root->next;
+  header.cycle_color = CycleGarbage;
+  cycle_garbage_.push_back(obj);
+  cycle_stack_.push_back(obj);
+  while (!cycle_stack_.empty()) {
+    __jsobject *cur = cycle_stack_.back();
+    cycle_stack_.pop_back();
+    ManageCycleNode(cur, COLLECT);
   }
 }
 
-void MemoryManager::RecallCycle() {
-  if (!cycle_roots) {
+// Run trial deletion from the most recent candidate roots, marking at most
+// cycle_budget_ objects.
+void MemoryManager::CollectCycles() {
+  if (TurnoffGC())
     return;
+  size_t end = cycle_roots_.size();
+  size_t begin = end;
+  bool over_budget = false;
+  cycle_work_ = 0;
+  while (begin > 0 && cycle_work_ < cycle_budget_) {
+    __jsobject *obj = cycle_roots_[--begin];
+    MemHeader &header = GetMemHeader(obj);
+    if (header.is_released) {
+      header.is_root = false;
+      RecallMem((void *)obj, sizeof(__jsobject));
+      cycle_roots_[begin] = NULL;
+    } else if (header.refcount == 0) {
+      // Only held by the runtime for now (see GCDecRfNoRecall), not a cycle.
+      header.is_root = false;
+      cycle_roots_[begin] = NULL;
+    } else if (!CycleMarkGray(obj)) {
+      // Left buffered for the next pause.
+      over_budget = true;
+      begin++;
+      break;
+    }
   }
-  CycleRoot *root = cycle_roots;
-  // Decrease cycle_roots
-  while (root) {
-    // this must not be a cycle header, so delete the node
-    if (!GetMemHeader(root->obj).refcount) {
-      DeleteCycleRootNode(root);
-    } else {
-      GetMemHeader(root->obj).is_decreased = true;
-      ManageObject(root->obj, DECREASE);
-    }
-    root = root->next;
-  }
-  root = cycle_roots;
-  // After decrement, if the refcount of a cycle-root object is greater than 0,
-  // then it needs to be restored.
-  bool need_restore = false;
-  while (root) {
-    if (GetMemHeader(root->obj).refcount) {
-      GetMemHeader(root->obj).need_restore = true;
-      need_restore = true;
-    }
-    root = root->next;
-  }
-  root = cycle_roots;
-  // Restore cycle_roots
-  if (need_restore) {
-    while (root) {
-      if (GetMemHeader(root->obj).need_restore) {
-        ManageObject(root->obj, RESTORE);
-      }
-      root = root->next;
-    }
-  }
-  root = cycle_roots;
-  // After decrement and restoring, if the refcount of a cycle-root object is 0, then this object
-  // is a garbage cycle header. Trace this header to collect garbage objects in this cycle.
-  while (root) {
-    CycleRoot *next_root = root->next;  // in case the current root is deleted after collected
-    if (!GetMemHeader(root->obj).refcount) {
-      if (!GetMemHeader(root->obj).is_collected) {
-        AddCycleRootNode(&garbage_roots, root->obj);
-        GetMemHeader(root->obj).is_collected = true;
-        ManageObject(root->obj, COLLECT);
-      }
-      DeleteCycleRootNode(root);
+  if (over_budget && begin == end) {
+    if (cycle_budget_ < 0x40000000) {
+      cycle_budget_ *= 2;
+    }
+  } else {
+    cycle_budget_ = CYCLE_PAUSE_WORK;
+  }
+  for (size_t i = begin; i < end; i++) {
+    if (cycle_roots_[i]) {
+      CycleScan(cycle_roots_[i]);
+    }
+  }
+  // The roots taken leave the buffer before any is released, so that they are
+  // released at once.
+  for (size_t i = begin; i < end; i++) {
+    if (cycle_roots_[i]) {
+      GetMemHeader(cycle_roots_[i]).is_root = false;
     }
-    root = next_root;
   }
-  root = garbage_roots;
-  // Sweep garbage-cycle
+  for (size_t i = begin; i < end; i++) {
+    if (cycle_roots_[i]) {
+      CycleCollectWhite(cycle_roots_[i]);
+    }
+  }
+  cycle_roots_.resize(begin);
+  // The references between garbage objects and environments were already
+  // dropped by DECREASE, the sweep only drops the ones to strings.
   is_sweep = true;
-  while (root) {
-    ManageObject(root->obj, SWEEP);
-    root = root->next;
+  for (size_t i = 0; i < cycle_garbage_.size(); i++) {
+    __jsobject *obj = cycle_garbage_[i];
+    GetMemHeader(obj).cycle_color = CycleBlack;
+    ManageCycleNode(obj, SWEEP);
   }
   is_sweep = false;
-  ResetCycleRoots();
-  RecallRoots(garbage_roots);
-  garbage_roots = NULL;
+  cycle_garbage_.clear();
+  cycle_skipped_.clear();
+  if (cycle_roots_.empty()) {
+    uint32 footprint = heap_free_small_offset_ + (heap_free_big_offset_ - total_small_size_);
+    cycle_alloc_bytes_ = 0;
+    cycle_trigger_bytes_ = footprint > CYCLE_GROWTH_MIN ? footprint : CYCLE_GROWTH_MIN;
+  }
 }
 
 #else
@@ -1528,6 +2211,16 @@ void MemoryManager::ManageObject(__jsobject *obj, ManageType flag) {
     ManageProp(jsprop, flag);
     jsprop = next_jsprop;
   }
+  if (obj->shape) {
+    uint32_t count = obj->shape->slot_count;
+    for (uint32_t i = 0; i < count; i++) {
+      __jsvalue jsvalue = obj->slots[i];
+      ManageJsvalue(&jsvalue, flag);
+    }
+    if (obj->slots && (flag == SWEEP || flag == RECALL)) {
+      RecallMem((void *)obj->slots, __jsshape_slot_capacity(count) * sizeof(__jsvalue));
+    }
+  }
 
   if (!obj->proto_is_builtin) {
     ManageChildObj(obj->prototype.obj, flag);
@@ -1543,14 +2236,14 @@ void MemoryManager::ManageObject(__jsobject *obj, ManageType flag) {
       /*TODO : Be related to VMReallocGC, AddrMapNode information will miss after VMReallocGC.  */
       if (obj->object_type == JSREGULAR_ARRAY) {
         __jsvalue *array = obj->shared.array_props;
-        uint32 arrlen = (uint32_t)__jsval_to_number(&array[0]);
+        uint32 arrlen = __jsarr_is_numeric(array) ? 0 :
+                        __jsarr_stored_length(array, (uint32_t)__jsval_to_number(&array[0]));
         for (uint32_t i = 0; i < arrlen; i++) {
           __jsvalue jsvalue = obj->shared.array_props[i + 1];
           ManageJsvalue(&jsvalue, flag);
         }
         if (flag == RECALL || flag == SWEEP) {
-          uint32_t size = (arrlen + 1) * sizeof(__jsvalue);
-          RecallMem((void *)obj->shared.array_props, size);
+          RecallMem((void *)(array - 1), __jsarr_block_size(__jsarr_capacity(array)));
         }
       }
       break;
@@ -1593,6 +2286,11 @@ void MemoryManager::ManageObject(__jsobject *obj, ManageType flag) {
       MIR_FATAL("manage unknown js object class");
   }
   if (flag == RECALL || flag == SWEEP) {
+    __jsobj_invalidate_layout(obj);
+#ifdef USE_PROP_MAP
+    if (obj->prop_string_map)
+      __jsprop_dict_free(obj->prop_string_map);
+#endif
     DeleteObjListNode(obj);
     RecallMem((void *)obj, sizeof(__jsobject));
   }